@@ -0,0 +1,210 @@
+#include "benchmark.h"
+#include "byte_util.h"
+#include "executor.h"
+#include "stats.h"
+
+#include <cstring>
+#include <linux/i2c.h>
+#include <stdexcept>
+
+namespace benchmark {
+
+// Byte order opposite to the native one, so every case has to swap.
+static constexpr bytes::endian foreign = bytes::endian::native ==
+                                                 bytes::endian::little
+                                             ? bytes::endian::big
+                                             : bytes::endian::little;
+
+static const size_t values = 1 << 20;
+
+struct result {
+  const char *name;
+  uint64_t ns;
+  size_t bytes;
+};
+
+static void print(text::writer &out, const result &r) {
+  out << r.name << ": " << r.ns / 1000 << " us, "
+      << (r.ns ? r.bytes * 1000 / r.ns : 0) << " MB/s\n";
+}
+
+template <typename F> static result measure(const char *name, size_t bytes, F f) {
+  const uint64_t start = stats::now_ns();
+  f();
+  return {name, stats::now_ns() - start, bytes};
+}
+
+static void check(const bytes::vect &expected, const bytes::byte *data,
+                  const char *name) {
+  if (std::memcmp(expected.data(), data, expected.size()) != 0)
+    throw std::runtime_error(std::string(name) + " produced different bytes");
+}
+
+void byte_order(text::writer &out) {
+  // Capture records: u64 timestamp, u16 mV, u16 mA.
+  std::vector<uint64_t> timestamps(values);
+  std::vector<uint16_t> samples(values * 2);
+  for (size_t i = 0; i < values; ++i) {
+    timestamps[i] = i * 250000;
+    samples[2 * i] = 5000 + i % 200;
+    samples[2 * i + 1] = 400 + i % 300;
+  }
+
+  const size_t size = values * 12;
+  bytes::vect reference;
+  bytes::vect data(size);
+
+  out << "Serializing " << values << " records of 12 bytes, swapping byte "
+      << "order\n";
+
+  print(out, measure("buffer, value by value", size, [&] {
+          bytes::buffer buffer(reference, foreign);
+          for (size_t i = 0; i < values; ++i)
+            buffer << timestamps[i] << samples[2 * i] << samples[2 * i + 1];
+        }));
+
+  print(out, measure("le/be, value by value", size, [&] {
+          bytes::vect result;
+          auto append = [&result](const bytes::vect &v) {
+            result.insert(result.end(), v.begin(), v.end());
+          };
+          for (size_t i = 0; i < values; ++i) {
+            const bool big = foreign == bytes::endian::big;
+            append(big ? bytes::be(timestamps[i]) : bytes::le(timestamps[i]));
+            append(big ? bytes::be(samples[2 * i]) : bytes::le(samples[2 * i]));
+            append(big ? bytes::be(samples[2 * i + 1])
+                       : bytes::le(samples[2 * i + 1]));
+          }
+          check(reference, result.data(), "le/be");
+        }));
+
+  print(out, measure("view, value by value", size, [&] {
+          bytes::view<bytes::byte> view(data, foreign);
+          for (size_t i = 0; i < values; ++i)
+            view << timestamps[i] << samples[2 * i] << samples[2 * i + 1];
+        }));
+  check(reference, data.data(), "view");
+
+  // Columns instead of records, the layout bulk conversion is made for.
+  out << "\nSerializing the same as columns\n";
+
+  print(out, measure("buffer, value by value", size, [&] {
+          bytes::buffer buffer(reference, foreign);
+          for (uint64_t t : timestamps)
+            buffer << t;
+          for (uint16_t s : samples)
+            buffer << s;
+        }));
+
+  print(out, measure("view, bulk", size, [&] {
+          bytes::view<bytes::byte> view(data, foreign);
+          view.write(std::span(timestamps)).write(std::span(samples));
+        }));
+  check(reference, data.data(), "bulk view");
+
+  std::vector<uint16_t> decoded(samples.size());
+  print(out, measure("view, bulk read", samples.size() * 2, [&] {
+          bytes::view<const bytes::byte> view(
+              std::span<const bytes::byte>(data).subspan(values * 8), foreign);
+          view.read(std::span(decoded));
+        }));
+
+  if (decoded != samples)
+    throw std::runtime_error("bulk read produced different values");
+
+  out.flush();
+}
+
+void adc_reads(text::writer &out, sw6106 &psu) {
+  static const unsigned snapshots = 1000;
+  // Both high registers are read once per channel.
+  static const unsigned getter_reads = 8;
+
+  volatile unsigned sink = 0;
+  const uint64_t getters_start = stats::now_ns();
+  for (unsigned i = 0; i < snapshots; ++i)
+    sink = sink + psu.get_battery_voltage_mv() + psu.get_output_voltage_mv() +
+           psu.get_charge_current_ma() + psu.get_discharge_current_ma();
+  const uint64_t getters_ns = stats::now_ns() - getters_start;
+
+  uint64_t reads = 0, tears = 0, inconsistent = 0;
+  const uint64_t start = stats::now_ns();
+  for (unsigned i = 0; i < snapshots; ++i) {
+    const auto r = psu.read_adc();
+    reads += r.reads;
+    tears += r.tears;
+    inconsistent += !r.consistent;
+  }
+  const uint64_t ns = stats::now_ns() - start;
+  const uint64_t hundredths = reads * 100 / snapshots % 100;
+
+  out << "Reading all ADC channels " << snapshots << " times\n"
+      << "individual getters: " << getters_ns / snapshots / 1000
+      << " us and " << getter_reads << " reads per snapshot\n"
+      << "read_adc: " << ns / snapshots / 1000 << " us and " << reads / snapshots
+      << (hundredths < 10 ? ".0" : ".") << hundredths << " reads per snapshot, "
+      << tears << " tears caught, " << inconsistent << " out of retries"
+      << text::endl;
+}
+
+// Answers every read with zeros, so only the overhead is left to measure.
+class null_bus : public i2c::bus {
+public:
+  int transfer(i2c_msg *messages, unsigned count) override {
+    for (unsigned i = 0; i < count; ++i)
+      if (messages[i].flags & I2C_M_RD)
+        std::memset(messages[i].buf, 0, messages[i].len);
+
+    return 0;
+  }
+};
+
+static async::task<void> read_charge(async::executor &e, sw6106 &psu,
+                                     unsigned count) {
+  for (unsigned i = 0; i < count; ++i)
+    co_await e.run([&psu] { return psu.get_charge_percent(); });
+}
+
+void async_i2c(text::writer &out) {
+  static const unsigned transactions = 100000;
+  static const unsigned in_flight = 32;
+
+  auto controller = std::make_shared<i2c::controller>("null");
+  controller->open(std::make_unique<null_bus>());
+  sw6106 psu(controller);
+
+  auto per_transaction = [](uint64_t ns) { return ns / transactions; };
+
+  volatile unsigned sink = 0;
+  const uint64_t direct_start = stats::now_ns();
+  for (unsigned i = 0; i < transactions; ++i)
+    sink = sink + psu.get_charge_percent();
+  const uint64_t direct = per_transaction(stats::now_ns() - direct_start);
+
+  async::executor executor(controller);
+
+  const uint64_t one_start = stats::now_ns();
+  async::sync_wait(executor, read_charge(executor, psu, transactions));
+  const uint64_t one = per_transaction(stats::now_ns() - one_start);
+
+  std::vector<async::task<void>> tasks;
+  for (unsigned i = 0; i < in_flight; ++i)
+    tasks.push_back(read_charge(executor, psu, transactions / in_flight));
+
+  const uint64_t many_start = stats::now_ns();
+  for (auto &t : tasks)
+    t.start();
+  for (auto &t : tasks)
+    async::sync_wait(executor, t);
+  const uint64_t many = per_transaction(stats::now_ns() - many_start);
+
+  out << transactions << " transactions to a bus that answers at once\n"
+      << "direct: " << direct << " ns per transaction\n"
+      << "executor, one in flight: " << one << " ns per transaction, "
+      << (one > direct ? one - direct : 0) << " ns overhead\n"
+      << "executor, " << in_flight << " in flight: " << many
+      << " ns per transaction, " << (many > direct ? many - direct : 0)
+      << " ns overhead" << text::endl;
+}
+
+} // namespace benchmark
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "sw6106.h"
+#include "text.h"
+
+// Microbenchmarks of the building blocks, run with --bytes-benchmark,
+// --adc-benchmark and --async-benchmark.
+
+namespace benchmark {
+
+/**
+ * Serialize the same records with the vect backed bytes::buffer, with the
+ * allocating bytes::le/be, and with bytes::view, one value at a time and in
+ * bulk, and print the throughput of each.
+ */
+void byte_order(text::writer &out);
+
+/**
+ * Read every ADC channel with sw6106::read_adc() and with the individual
+ * getters, and print the time and bus reads each takes along with the tears
+ * read_adc() caught.
+ */
+void adc_reads(text::writer &out, sw6106 &psu);
+
+/**
+ * Send transactions to a bus that answers at once, directly and through an
+ * async::executor, one at a time and many in flight, and print the cost of
+ * each per transaction.
+ */
+void async_i2c(text::writer &out);
+
+} // namespace benchmark
@@ -4,6 +4,7 @@
 #include <bit>
 #include <cstring>
 #include <ios>
+#include <span>
 #include <stdexcept>
 #include <stdint.h>
 #include <type_traits>
@@ -18,41 +19,72 @@ template <typename T>
 concept arithmetic = std::is_arithmetic<T>::value;
 
 // C++23 std::byteswap can't swap anything but integers. But this can swap
-// anything!
-template <size_t size> inline void ___bswap(char *data);
+// anything! Goes through an unsigned integer of the same size, which the
+// compiler turns into a single bswap/rev instruction.
+template <size_t size> struct uint_of_size;
+template <> struct uint_of_size<1> { using type = uint8_t; };
+template <> struct uint_of_size<2> { using type = uint16_t; };
+template <> struct uint_of_size<4> { using type = uint32_t; };
+template <> struct uint_of_size<8> { using type = uint64_t; };
+
+template <typename T> inline T byteswapped(T value) {
+  using uint = typename uint_of_size<sizeof(T)>::type;
+
+  uint bits;
+  std::memcpy(&bits, &value, sizeof(T));
+
+  if constexpr (sizeof(T) == 2)
+    bits = __builtin_bswap16(bits);
+  else if constexpr (sizeof(T) == 4)
+    bits = __builtin_bswap32(bits);
+  else if constexpr (sizeof(T) == 8)
+    bits = __builtin_bswap64(bits);
+
+  std::memcpy(&value, &bits, sizeof(T));
+  return value;
+}
+
+template <typename T> void byteswap(T &value) { value = byteswapped(value); }
+
+// Bulk version, a plain loop the compiler vectorizes into byte shuffles.
+template <arithmetic T> void byteswap(std::span<T> values) {
+  for (T &value : values)
+    value = byteswapped(value);
+}
 
-template <> inline void ___bswap<1>(char *data) {}
+// In place encoders and decoders, nothing is allocated. Unaligned pointers
+// are fine.
+template <arithmetic T> inline void write(byte *out, T val, endian e) {
+  if (e != endian::native)
+    byteswap(val);
 
-template <> inline void ___bswap<2>(char *data) {
-  auto *ptr = reinterpret_cast<uint16_t *>(data);
-  *ptr = (*ptr >> 8) | (*ptr << 8);
+  std::memcpy(out, &val, sizeof(T));
 }
 
-template <> inline void ___bswap<4>(char *data) {
-  // clang-format off
-  // Otherwise this nice arrangement would be ruined
-  auto *ptr = reinterpret_cast<uint32_t *>(data);
-  *ptr = (*ptr >> 24) |
-         ((*ptr & 0x00ff0000) >> 8) |
-         ((*ptr & 0x0000ff00) << 8) |
-         (*ptr << 24);
+template <arithmetic T> inline T read(const byte *in, endian e) {
+  T val;
+  std::memcpy(&val, in, sizeof(T));
+
+  if (e != endian::native)
+    byteswap(val);
+
+  return val;
 }
 
-template <> inline void ___bswap<8>(char *data) {
-  auto *ptr = reinterpret_cast<uint64_t *>(data);
-  *ptr = (*ptr >> 56) |
-         ((0x000000000000ff00ULL & *ptr) << 40) |
-         ((0x0000000000ff0000ULL & *ptr) << 24) |
-         ((0x00000000ff000000ULL & *ptr) << 8)  |
-         ((0x000000ff00000000ULL & *ptr) >> 8 ) |
-         ((0x0000ff0000000000ULL & *ptr) >> 24) |
-         ((0x00ff000000000000ULL & *ptr) >> 40) |
-         (*ptr << 56);
-  // clang-format on
+template <arithmetic T> inline void write_le(byte *out, T val) {
+  write(out, val, endian::little);
 }
 
-template <typename T> void byteswap(T &value) {
-  ___bswap<sizeof(T)>(reinterpret_cast<char *>(&value));
+template <arithmetic T> inline void write_be(byte *out, T val) {
+  write(out, val, endian::big);
+}
+
+template <arithmetic T> inline T read_le(const byte *in) {
+  return read<T>(in, endian::little);
+}
+
+template <arithmetic T> inline T read_be(const byte *in) {
+  return read<T>(in, endian::big);
 }
 
 template <arithmetic T> vect serialize(T val) {
@@ -62,17 +94,47 @@ template <arithmetic T> vect serialize(T val) {
 }
 
 template <arithmetic T> vect le(T val) {
-  if (endian::little != endian::native)
-    byteswap(val);
-
-  return serialize(val);
+  vect result(sizeof(T));
+  write_le(result.data(), val);
+  return result;
 }
 
 template <arithmetic T> vect be(T val) {
-  if (endian::big != endian::native)
-    byteswap(val);
+  vect result(sizeof(T));
+  write_be(result.data(), val);
+  return result;
+}
+
+// Zig-zag folds signed values into unsigned ones so small magnitudes of
+// either sign stay small: 0, -1, 1, -2... become 0, 1, 2, 3...
+inline uint64_t zigzag(int64_t val) {
+  return (static_cast<uint64_t>(val) << 1) ^ static_cast<uint64_t>(val >> 63);
+}
+
+inline int64_t unzigzag(uint64_t val) {
+  return static_cast<int64_t>(val >> 1) ^ -static_cast<int64_t>(val & 1);
+}
 
-  return serialize(val);
+// LEB128 style varint: 7 bits per byte, least significant group first, high
+// bit set on every byte but the last.
+inline void put_varint(vect &out, uint64_t val) {
+  while (val >= 0x80) {
+    out.push_back(static_cast<byte>(val) | 0x80);
+    val >>= 7;
+  }
+  out.push_back(static_cast<byte>(val));
+}
+
+// Returns the number of bytes consumed, 0 if the varint is truncated or
+// longer than 64 bits.
+inline size_t get_varint(const byte *data, size_t size, uint64_t &val) {
+  val = 0;
+  for (size_t i = 0; i < size && i < 10; ++i) {
+    val |= static_cast<uint64_t>(data[i] & 0x7f) << (7 * i);
+    if ((data[i] & 0x80) == 0)
+      return i + 1;
+  }
+  return 0;
 }
 
 template <typename T>
@@ -85,10 +147,6 @@ template <ByteVect Vect> class buffer {
                    typename Vect::iterator>::type mutable m_current_point;
   mutable endian m_endianness;
 
-  template <typename V>
-  using disable_if_const =
-      std::enable_if_t<std::is_const<Vect>::value == false, V>;
-
 public:
   buffer(Vect &buf, endian e = endian::native)
       : m_buffer(buf), m_current_point(m_buffer.begin()), m_endianness(e) {}
@@ -145,7 +203,10 @@ public:
     return *this;
   }
 
-  template <arithmetic T> disable_if_const<T> &operator<<(T in) {
+  template <arithmetic T>
+  buffer &operator<<(T in)
+    requires(!std::is_const<Vect>::value)
+  {
     auto distance = std::distance(m_current_point, m_buffer.end());
     if (distance < sizeof(T)) {
       // preserve iterator...
@@ -169,4 +230,89 @@ public:
   }
 };
 
+
+// Fixed size counterpart of buffer over any contiguous memory: stack arrays,
+// mmap regions, a part of a vect. Never allocates, running past the end
+// throws instead of growing. A view of const bytes is read only.
+template <typename Byte>
+  requires std::is_same<std::remove_const_t<Byte>, byte>::value
+class view {
+  std::span<Byte> m_data;
+  size_t m_position = 0;
+  endian m_endianness;
+
+  static constexpr bool writable = !std::is_const<Byte>::value;
+
+  void reserve(size_t size) const {
+    if (m_data.size() - m_position < size)
+      throw std::out_of_range("Trying to access past the end of the view.");
+  }
+
+public:
+  view(std::span<Byte> data, endian e = endian::native)
+      : m_data(data), m_endianness(e) {}
+
+  void seek(size_t position) {
+    if (position > m_data.size())
+      throw std::out_of_range("Trying to seek past the end of the view.");
+
+    m_position = position;
+  }
+
+  size_t tell() const { return m_position; }
+  size_t remaining() const { return m_data.size() - m_position; }
+
+  /// What has been read or written so far.
+  std::span<Byte> consumed() const { return m_data.first(m_position); }
+
+  void set_endianness(endian e) { m_endianness = e; }
+  endian endianness() const { return m_endianness; }
+
+  template <arithmetic T> view &operator>>(T &out) {
+    reserve(sizeof(T));
+    out = bytes::read<T>(m_data.data() + m_position, m_endianness);
+    m_position += sizeof(T);
+    return *this;
+  }
+
+  template <arithmetic T>
+  view &operator<<(T in)
+    requires writable
+  {
+    reserve(sizeof(T));
+    bytes::write(m_data.data() + m_position, in, m_endianness);
+    m_position += sizeof(T);
+    return *this;
+  }
+
+  /// Read an array of values in one go.
+  template <arithmetic T> view &read(std::span<T> out) {
+    reserve(out.size_bytes());
+    std::memcpy(out.data(), m_data.data() + m_position, out.size_bytes());
+    if (m_endianness != endian::native)
+      byteswap(out);
+
+    m_position += out.size_bytes();
+    return *this;
+  }
+
+  /// Write an array of values in one go.
+  template <arithmetic T>
+  view &write(std::span<T> in)
+    requires writable
+  {
+    reserve(in.size_bytes());
+    byte *out = m_data.data() + m_position;
+
+    if (m_endianness == endian::native)
+      std::memcpy(out, in.data(), in.size_bytes());
+    else
+      for (size_t i = 0; i < in.size(); ++i)
+        bytes::write(out + i * sizeof(T), in[i], m_endianness);
+
+    m_position += in.size_bytes();
+    return *this;
+  }
+};
+
 } // namespace bytes
@@ -0,0 +1,142 @@
+#include "capture.h"
+#include "stats.h"
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+static const uint64_t max_rate_hz = 4000;
+static const uint16_t binary_version = 1;
+static const uint16_t binary_record_size = 12;
+
+burst_capture::burst_capture(std::chrono::milliseconds duration,
+                             const std::filesystem::path &output, format f)
+    : m_duration(duration), m_output(output), m_format(f) {
+  if (duration <= std::chrono::milliseconds(0) || duration > max_duration)
+    throw std::invalid_argument(
+        "Capture duration should be between 1 and " +
+        std::to_string(max_duration.count()) + " ms");
+
+  m_records.resize(duration.count() * max_rate_hz / 1000 + 1);
+  m_encoded.resize(12 + m_records.size() * binary_record_size);
+}
+
+burst_capture::summary burst_capture::run(sw6106 &psu) {
+  const uint64_t start = stats::now_ns();
+  const uint64_t end = start + m_duration.count() * 1000000ULL;
+
+  m_count = 0;
+  uint64_t now = start;
+
+  while (now < end && m_count < m_records.size()) {
+    record &r = m_records[m_count++];
+    r.timestamp_ns = now;
+    r.adc = psu.read_output_adc();
+
+    now = stats::now_ns();
+  }
+
+  summary s;
+  s.samples = m_count;
+  s.buffer_full = m_count == m_records.size() && now < end;
+
+  if (m_count < 2)
+    return s;
+
+  s.duration_ns = m_records[m_count - 1].timestamp_ns - m_records[0].timestamp_ns;
+  s.rate_hz = (m_count - 1) * 1000000000ULL / s.duration_ns;
+  s.avg_interval_ns = s.duration_ns / (m_count - 1);
+  s.min_interval_ns = UINT64_MAX;
+
+  double variance = 0;
+  for (size_t i = 1; i < m_count; ++i) {
+    const uint64_t interval =
+        m_records[i].timestamp_ns - m_records[i - 1].timestamp_ns;
+
+    s.min_interval_ns = std::min(s.min_interval_ns, interval);
+    s.max_interval_ns = std::max(s.max_interval_ns, interval);
+
+    const double deviation = double(interval) - double(s.avg_interval_ns);
+    variance += deviation * deviation;
+  }
+
+  s.interval_stddev_ns = std::sqrt(variance / (m_count - 1));
+
+  return s;
+}
+
+static void write_all(int fd, const bytes::byte *data, size_t size) {
+  while (size > 0) {
+    ssize_t res = ::write(fd, data, size);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      throw std::runtime_error(std::string("Failed to write capture: ") +
+                               strerror(errno));
+    data += res;
+    size -= res;
+  }
+}
+
+void burst_capture::write() {
+  const bool to_stdout = m_output.native() == "-";
+  const int fd = to_stdout ? STDOUT_FILENO
+                           : ::open(m_output.c_str(),
+                                    O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                                    0644);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open " + m_output.generic_string() +
+                             ": " + strerror(errno));
+
+  // Closed however the write ends, a failed one included. Not stdout.
+  struct closer {
+    int fd;
+    ~closer() {
+      if (fd != STDOUT_FILENO)
+        ::close(fd);
+    }
+  } const guard{to_stdout ? STDOUT_FILENO : fd};
+
+  const uint64_t origin = m_count ? m_records[0].timestamp_ns : 0;
+
+  if (m_format == format::CSV) {
+    text::writer out(fd);
+    out << "time_us,output_voltage_mv,discharge_current_ma\n";
+    for (size_t i = 0; i < m_count; ++i) {
+      const record &r = m_records[i];
+      out << (r.timestamp_ns - origin) / 1000 << ','
+          << r.adc.output_voltage_mv() << ',' << r.adc.discharge_current_ma()
+          << '\n';
+    }
+    out.flush();
+  } else {
+    bytes::view<bytes::byte> buffer(m_encoded, bytes::endian::little);
+    buffer << 'S' << 'W' << '6' << 'C' << binary_version << binary_record_size
+           << static_cast<uint32_t>(m_count);
+
+    for (size_t i = 0; i < m_count; ++i) {
+      const record &r = m_records[i];
+      buffer << (r.timestamp_ns - origin)
+             << static_cast<uint16_t>(r.adc.output_voltage_mv())
+             << static_cast<uint16_t>(r.adc.discharge_current_ma());
+    }
+
+    write_all(fd, m_encoded.data(), buffer.tell());
+  }
+}
+
+text::writer &operator<<(text::writer &out, const burst_capture::summary &s) {
+  out << "Captured " << s.samples << " samples in " << s.duration_ns / 1000
+      << " us, " << s.rate_hz << " Hz\nSample interval: min "
+      << s.min_interval_ns / 1000 << " us, avg " << s.avg_interval_ns / 1000
+      << " us, max " << s.max_interval_ns / 1000 << " us, jitter (stddev) "
+      << s.interval_stddev_ns / 1000 << " us";
+
+  if (s.buffer_full)
+    out << "\nBuffer filled up before the end of the capture";
+
+  return out;
+}
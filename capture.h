@@ -0,0 +1,78 @@
+#pragma once
+
+#include "byte_util.h"
+#include "sw6106.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/**
+ * High rate capture of output voltage and discharge current, for looking at
+ * load transients. The output side ADC registers are read back to back as
+ * fast as the bus allows into a buffer allocated upfront, and are decoded
+ * only when the capture is written out.
+ */
+class burst_capture {
+public:
+  enum class format { CSV, BINARY };
+
+  struct record {
+    uint64_t timestamp_ns; // CLOCK_MONOTONIC
+    sw6106::output_adc adc;
+  };
+
+  struct summary {
+    size_t samples = 0;
+    uint64_t duration_ns = 0;
+    uint64_t rate_hz = 0;
+    uint64_t min_interval_ns = 0;
+    uint64_t avg_interval_ns = 0;
+    uint64_t max_interval_ns = 0;
+    uint64_t interval_stddev_ns = 0;
+    bool buffer_full = false;
+  };
+
+  /// Longest capture allowed, the buffer grows with the duration.
+  static constexpr std::chrono::milliseconds max_duration{60000};
+
+private:
+  std::chrono::milliseconds m_duration;
+  std::filesystem::path m_output;
+  format m_format;
+
+  std::vector<record> m_records;
+  size_t m_count = 0;
+  bytes::vect m_encoded; // binary output, allocated upfront as well
+
+public:
+  /**
+   * Allocate room for a capture of the given duration. The buffer is sized
+   * for 4 kHz, a bit more than four single byte reads per sample can reach
+   * on a 400 kHz bus. Where and how it's written is settled here as well,
+   * nothing is allocated for a capture later on.
+   * @param output file to write, "-" for stdout.
+   */
+  burst_capture(std::chrono::milliseconds duration,
+                const std::filesystem::path &output, format f);
+
+  /**
+   * Sample until the duration is over or the buffer is full. The device is
+   * not available to anything else meanwhile.
+   */
+  summary run(sw6106 &psu);
+
+  /**
+   * Write the last capture out.
+   * CSV has a header and one line per sample: time since the first sample in
+   * microseconds, output voltage in mV and discharge current in mA.
+   * The binary format is little endian: "SW6C", u16 version, u16 record
+   * size, u32 record count, then per record u64 time since the first sample
+   * in ns, u16 mV, u16 mA.
+   * @throw std::runtime_error if the file can't be opened or written.
+   */
+  void write();
+};
+
+text::writer &operator<<(text::writer &out, const burst_capture::summary &s);
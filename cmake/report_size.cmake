@@ -0,0 +1,8 @@
+# Print the size of a build artifact, to keep an eye on the footprint of the
+# full and lean variants. Usage: cmake -DFILE=<path> -P report_size.cmake
+
+file(SIZE ${FILE} size)
+math(EXPR size_kb "${size} / 1024")
+get_filename_component(name ${FILE} NAME)
+
+message("${name}: ${size} bytes (${size_kb} KiB)")
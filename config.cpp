@@ -1,9 +1,14 @@
 #include "config.h"
+#include "text.h"
 
-#include <fstream>
-#include <iostream>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sched.h>
 #include <set>
-#include <sstream>
+#include <string_view>
+#include <unistd.h>
 
 #define QUOTE(name) #name
 #define STR(macro) QUOTE(macro)
@@ -15,20 +20,195 @@ CONF_PARAM(gpio_interrupt_line)
 CONF_PARAM(poll_interval)
 CONF_PARAM(low_charge_voltage_mv)
 CONF_PARAM(low_charge_percent)
+CONF_PARAM(rule)
+CONF_PARAM(poweroff_command)
+CONF_PARAM(poweroff_deadline_ms)
+CONF_PARAM(pre_shutdown_hooks_dir)
+CONF_PARAM(pre_shutdown_hook_timeout_ms)
+CONF_PARAM(simulated_poweroff_command)
+CONF_PARAM(simulated_pre_shutdown_hooks)
+CONF_PARAM(battery_capacity_mah)
+CONF_PARAM(realtime_policy)
+CONF_PARAM(realtime_priority)
+CONF_PARAM(lock_memory)
+CONF_PARAM(cpu_affinity)
+CONF_PARAM(low_power)
+CONF_PARAM(low_power_timer_slack_ms)
+CONF_PARAM(filter_median_window)
+CONF_PARAM(filter_ewma_shift)
+CONF_PARAM(filter_outlier_mv)
+CONF_PARAM(filter_outlier_ma)
+CONF_PARAM(telemetry_archive)
+CONF_PARAM(telemetry_block_records)
+CONF_PARAM(capture_duration_ms)
+CONF_PARAM(capture_output)
+CONF_PARAM(capture_format)
+CONF_PARAM(i2c_trace)
+CONF_PARAM(i2c_timeout_ms)
+CONF_PARAM(i2c_retries)
+CONF_PARAM(i2c_latency_budget_ms)
+CONF_PARAM(energy_ledger)
+CONF_PARAM(energy_flush_interval_s)
+CONF_PARAM(battery_health)
+
+static bool parse_bool(const std::string &option, const std::string &value) {
+  if (value == "yes" || value == "true" || value == "1")
+    return true;
+
+  if (value == "no" || value == "false" || value == "0")
+    return false;
+
+  throw std::invalid_argument(option + " should be either yes or no");
+}
+
+static const std::string i2c_dev_auto = "auto";
+
+namespace {
+
+// Splits a config line into whitespace separated tokens, the way an
+// std::istringstream would, minus the stream.
+class tokenizer {
+  std::string_view m_rest;
+
+  std::string_view next() {
+    const size_t start = m_rest.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+      m_rest = {};
+      return {};
+    }
+
+    m_rest.remove_prefix(start);
+    const size_t end = std::min(m_rest.find_first_of(" \t\r"), m_rest.size());
+    std::string_view token = m_rest.substr(0, end);
+    m_rest.remove_prefix(end);
+
+    return token;
+  }
+
+public:
+  tokenizer(std::string_view line) : m_rest(line) {}
+
+  /// Everything not read yet, up to a comment, without surrounding blanks.
+  std::string_view rest() const {
+    std::string_view rest = m_rest.substr(0, m_rest.find('#'));
+    const size_t start = rest.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos)
+      return {};
+
+    rest.remove_prefix(start);
+    return rest.substr(0, rest.find_last_not_of(" \t\r") + 1);
+  }
+
+  tokenizer &operator>>(std::string &out) {
+    out = next();
+    return *this;
+  }
+
+  tokenizer &operator>>(std::filesystem::path &out) {
+    std::string_view token = next();
+    if (token.size() >= 2 && token.front() == '"' && token.back() == '"')
+      token = token.substr(1, token.size() - 2);
+
+    out = token;
+    return *this;
+  }
+
+  // Like a stream, a malformed number reads as 0 and is left to the range
+  // checks to reject.
+  template <std::integral T> tokenizer &operator>>(T &out) {
+    const std::string_view token = next();
+    if (std::from_chars(token.data(), token.data() + token.size(), out).ec !=
+        std::errc())
+      out = 0;
+
+    return *this;
+  }
+};
+
+std::string read_file(const std::filesystem::path &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::invalid_argument(std::string("Failed to open config file ") +
+                                path.generic_string());
+
+  std::string content;
+  char buffer[4096];
+
+  while (true) {
+    const ssize_t res = ::read(fd, buffer, sizeof(buffer));
+    if (res < 0 && errno == EINTR)
+      continue;
+
+    if (res < 0) {
+      const int err = errno;
+      ::close(fd);
+      throw std::runtime_error("Error while reading config file " +
+                               path.generic_string() + ": " + strerror(err));
+    }
+
+    if (res == 0)
+      break;
+
+    content.append(buffer, res);
+  }
+
+  ::close(fd);
+  return content;
+}
+
+} // namespace
 
 void config::read_cli_args(int argc, const char **argv) {
   for (int argno = 1; argno < argc; ++argno) {
     std::string arg = argv[argno];
 
     if (arg == "-h" || arg == "--help") {
-      std::cout
+      text::out()
           << argv[0] << " options:\n"
           << "\t-h | --help :\t\tprint this help\n"
              "\t-s | --single-run :\tquery once and exit\n"
              "\t-i | --i2c_dev : \toverride i2c device (will ignore similar "
-             "option in config file)\n"
+             "option in config file). Use \"auto\" to search all buses, "
+             "\"sim:[script]\" for a simulated device\n"
+             "\t-S | --stats :\t\tprint timing statistics on exit. Send "
+             "SIGUSR1 to print them at any time\n"
+             "\t-j | --jitter-check :\tapply scheduling settings from the "
+             "config, measure wakeup jitter for 10 s and exit\n"
+             "\t-d | --discover :\tsearch all i2c buses for sw6106, print a "
+             "config and exit\n"
+             "\t--export <archive> :\tprint a telemetry archive as CSV and "
+             "exit\n"
+             "\t--energy <ledger> :\tprint the energy totals of a ledger "
+             "and exit\n"
+             "\t--health <file> :\tprint the battery health record of a pack "
+             "and exit\n"
+             "\t--archive-benchmark :\tround trip synthetic telemetry through "
+             "the archive codec, print compression and speed and exit\n"
+             "\t--bytes-benchmark :\tcompare the serialization helpers and "
+             "exit\n"
+             "\t--rules-benchmark :\tevaluate 500 rules over synthetic samples, "
+             "print the cost and exit\n"
+             "\t--adc-benchmark :\tcompare tear-free ADC reads with the "
+             "individual getters on the device and exit\n"
+             "\t--async-benchmark :\tmeasure the queueing overhead of the "
+             "async i2c executor per transaction and exit\n"
+             "\t--capture <ms> :\tsample output voltage and discharge "
+             "current as fast as possible for <ms>, write them out and exit\n"
+             "\t--capture-output :\tcapture file, \"-\" for stdout. Default "
+             "value: -\n"
+             "\t--capture-format :\tcapture format, csv or bin. Default "
+             "value: csv\n"
+             "\t--record <trace> :\trecord every i2c transaction into a "
+             "trace file\n"
+             "\t--replay <trace> :\tplay a trace back instead of talking to "
+             "the device\n"
+             "\t--replay-speed <n> :\treplay n times faster than recorded, 0 "
+             "for as fast as possible. Default value: 0\n"
+             "\t--soak <cycles> :\trun <cycles> cycles back to back against "
+             "the simulator with the config file, request a capture and a "
+             "reload halfway, fail if any of them allocated and exit\n"
              "\t-c | --config :\t\tset config path. Default value: "
-          << SW6106_DEFAULT_CONFIG_PATH << std::endl;
+          << SW6106_DEFAULT_CONFIG_PATH << text::endl;
 
       exit(0);
     }
@@ -38,6 +218,150 @@ void config::read_cli_args(int argc, const char **argv) {
       continue;
     }
 
+    if (arg == "-S" || arg == "--stats") {
+      m_print_stats = true;
+      continue;
+    }
+
+    if (arg == "-j" || arg == "--jitter-check") {
+      m_jitter_check = true;
+      continue;
+    }
+
+    if (arg == "-d" || arg == "--discover") {
+      m_discover = true;
+      continue;
+    }
+
+    if (arg == "--export") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Archive argument missing");
+
+      m_export_archive = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--energy") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Energy ledger argument missing");
+
+      m_energy_query = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--health") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Battery health argument missing");
+
+      m_health_query = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--archive-benchmark") {
+      m_archive_benchmark = true;
+      continue;
+    }
+
+    if (arg == "--bytes-benchmark") {
+      m_bytes_benchmark = true;
+      continue;
+    }
+
+    if (arg == "--rules-benchmark") {
+      m_rules_benchmark = true;
+      continue;
+    }
+
+    if (arg == "--adc-benchmark") {
+      m_adc_benchmark = true;
+      continue;
+    }
+
+    if (arg == "--async-benchmark") {
+      m_async_benchmark = true;
+      continue;
+    }
+
+    if (arg == "--capture") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Capture duration argument missing");
+
+      int duration = 0;
+      std::from_chars(argv[argno + 1],
+                      argv[argno + 1] + std::strlen(argv[argno + 1]), duration);
+      m_capture = true;
+      m_capture_duration = std::chrono::milliseconds(duration);
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--capture-output") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Capture output argument missing");
+
+      m_capture_output = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--capture-format") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Capture format argument missing");
+
+      m_capture_format = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--record") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Trace argument missing");
+
+      m_i2c_trace = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--replay") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Trace argument missing");
+
+      m_replay_trace = argv[argno + 1];
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--replay-speed") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Replay speed argument missing");
+
+      const char *value = argv[argno + 1];
+      const auto [end, ec] =
+          std::from_chars(value, value + std::strlen(value), m_replay_speed);
+      if (ec != std::errc() || *end != '\0')
+        throw std::invalid_argument("Replay speed should be a number");
+
+      ++argno;
+      continue;
+    }
+
+    if (arg == "--soak") {
+      if (argno + 1 >= argc)
+        throw std::invalid_argument("Soak cycles argument missing");
+
+      const char *value = argv[argno + 1];
+      const auto [end, ec] =
+          std::from_chars(value, value + std::strlen(value), m_soak_cycles);
+      if (ec != std::errc() || *end != '\0' || m_soak_cycles == 0)
+        throw std::invalid_argument("Soak cycles should be a number above 0");
+
+      ++argno;
+      continue;
+    }
+
     if (arg == "-i" || arg == "--i2c_dev") {
       if (argno + 1 >= argc)
         throw std::invalid_argument("I2C device argument missing");
@@ -61,32 +385,63 @@ void config::read_cli_args(int argc, const char **argv) {
 }
 
 void config::read_config_file() {
-  std::ifstream cfg(m_conf_path);
-  if (!cfg.is_open())
-    throw std::invalid_argument(std::string("Failed to open config file ") +
-                                m_conf_path.generic_string());
-
-  std::string line;
+  const std::string content = read_file(m_conf_path);
+  std::string_view remaining = content;
   uint lineno = 0;
 
   std::set<std::string> options_to_find = {
-      i2c_dev,       gpio_interrupt_chip,   gpio_interrupt_line,
-      poll_interval, low_charge_voltage_mv, low_charge_percent};
+      i2c_dev,          gpio_interrupt_chip,   gpio_interrupt_line,
+      poll_interval,    low_charge_voltage_mv, low_charge_percent,
+      poweroff_command, poweroff_deadline_ms,  pre_shutdown_hooks_dir,
+      pre_shutdown_hook_timeout_ms,            battery_capacity_mah,
+      simulated_poweroff_command,              simulated_pre_shutdown_hooks,
+      realtime_policy,  realtime_priority,     lock_memory,
+      cpu_affinity,     low_power,             low_power_timer_slack_ms,
+      filter_median_window,                    filter_ewma_shift,
+      filter_outlier_mv,                       filter_outlier_ma,
+      telemetry_archive,                       telemetry_block_records,
+      capture_duration_ms,                     capture_output,
+      capture_format,                          i2c_trace,
+      i2c_timeout_ms,   i2c_retries,           i2c_latency_budget_ms,
+      energy_ledger,                           energy_flush_interval_s,
+      battery_health};
 
   std::set<std::string> options_found;
 
-  while (getline(cfg, line)) {
+  while (!remaining.empty()) {
+    const size_t eol = std::min(remaining.find('\n'), remaining.size());
+    const std::string_view line = remaining.substr(0, eol);
+    remaining.remove_prefix(std::min(eol + 1, remaining.size()));
+
     ++lineno;
     if (line.size() == 0)
       continue;
 
-    std::stringstream tokenize(line, std::ios_base::in);
+    tokenizer tokenize(line);
     std::string option;
     tokenize >> option;
 
     if (option.starts_with('#'))
       continue;
 
+    // The only option that may be repeated, one line per rule.
+    if (option == rule) {
+      std::string equals;
+      tokenize >> equals;
+
+      if (equals != "=")
+        throw std::invalid_argument("Syntax error at line " +
+                                    std::to_string(lineno));
+
+      try {
+        m_rules.add(tokenize.rest());
+      } catch (std::invalid_argument &e) {
+        throw std::invalid_argument(std::string(e.what()) + ", rule at line " +
+                                    std::to_string(lineno));
+      }
+      continue;
+    }
+
     if (options_found.contains(option))
       throw std::invalid_argument("Redefenition of \"" + option +
                                   "\" at line " + std::to_string(lineno));
@@ -137,31 +492,253 @@ void config::read_config_file() {
         throw std::invalid_argument(
             "low_charge_percent should have a value between 1 and 100");
     }
-  }
 
-  if (cfg.bad())
-    throw std::runtime_error("Error while reading config file " +
-                             m_conf_path.generic_string());
+    if (option == poweroff_command)
+      tokenize >> m_poweroff_command;
+
+    if (option == poweroff_deadline_ms) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 100 || arg > 60000)
+        throw std::invalid_argument(
+            "poweroff_deadline_ms should have a value between 100 and 60000");
+
+      m_poweroff_deadline = std::chrono::milliseconds(arg);
+    }
+
+    if (option == pre_shutdown_hooks_dir)
+      tokenize >> m_pre_shutdown_hooks_dir;
+
+    if (option == pre_shutdown_hook_timeout_ms) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 1)
+        throw std::invalid_argument(
+            "pre_shutdown_hook_timeout_ms should have a value greater than 0");
+
+      m_pre_shutdown_hook_timeout = std::chrono::milliseconds(arg);
+    }
+
+    if (option == simulated_poweroff_command)
+      tokenize >> m_simulated_poweroff_command;
+
+    if (option == simulated_pre_shutdown_hooks) {
+      std::string arg;
+      tokenize >> arg;
+      m_simulated_pre_shutdown_hooks = parse_bool(option, arg);
+    }
+
+    if (option == battery_capacity_mah) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 100 || arg > 100000)
+        throw std::invalid_argument(
+            "battery_capacity_mah should have a value between 100 and 100000");
+
+      m_battery_capacity = arg;
+    }
+
+    if (option == realtime_policy) {
+      std::string arg;
+      tokenize >> arg;
+      if (arg == "other")
+        m_realtime_policy = realtime::policy::OTHER;
+      else if (arg == "fifo")
+        m_realtime_policy = realtime::policy::FIFO;
+      else if (arg == "rr")
+        m_realtime_policy = realtime::policy::RR;
+      else
+        throw std::invalid_argument(
+            "realtime_policy should be one of: other, fifo, rr");
+    }
+
+    if (option == realtime_priority) {
+      tokenize >> m_realtime_priority;
+      if (m_realtime_priority < 1 || m_realtime_priority > 99)
+        throw std::invalid_argument(
+            "realtime_priority should have a value between 1 and 99");
+    }
+
+    if (option == lock_memory) {
+      std::string arg;
+      tokenize >> arg;
+      m_lock_memory = parse_bool(option, arg);
+    }
+
+    if (option == cpu_affinity) {
+      tokenize >> m_cpu_affinity;
+      if (m_cpu_affinity < 0 || m_cpu_affinity >= CPU_SETSIZE)
+        throw std::invalid_argument("cpu_affinity should be a valid CPU number");
+    }
+
+    if (option == low_power) {
+      std::string arg;
+      tokenize >> arg;
+      m_low_power = parse_bool(option, arg);
+    }
+
+    if (option == low_power_timer_slack_ms) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 1 || arg > 1000)
+        throw std::invalid_argument(
+            "low_power_timer_slack_ms should have a value between 1 and 1000");
+
+      m_timer_slack = std::chrono::milliseconds(arg);
+    }
+
+    if (option == filter_median_window) {
+      tokenize >> m_filter_median_window;
+      if (m_filter_median_window < 1 ||
+          m_filter_median_window > filter::settings::max_median_window ||
+          m_filter_median_window % 2 == 0)
+        throw std::invalid_argument(
+            "filter_median_window should be an odd value between 1 and " +
+            std::to_string(filter::settings::max_median_window));
+    }
+
+    if (option == filter_ewma_shift) {
+      tokenize >> m_filter_ewma_shift;
+      if (m_filter_ewma_shift > 8)
+        throw std::invalid_argument(
+            "filter_ewma_shift should have a value between 0 and 8");
+    }
+
+    if (option == filter_outlier_mv)
+      tokenize >> m_filter_outlier_mv;
+
+    if (option == filter_outlier_ma)
+      tokenize >> m_filter_outlier_ma;
+
+    if (option == telemetry_archive)
+      tokenize >> m_telemetry_archive;
+
+    if (option == energy_ledger)
+      tokenize >> m_energy_ledger;
+
+    if (option == energy_flush_interval_s) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 1 || arg > 86400)
+        throw std::invalid_argument(
+            "energy_flush_interval_s should have a value between 1 and 86400");
+
+      m_energy_flush_interval = std::chrono::seconds(arg);
+    }
+
+    if (option == battery_health)
+      tokenize >> m_battery_health;
+
+    if (option == telemetry_block_records) {
+      tokenize >> m_telemetry_block_records;
+      if (m_telemetry_block_records < 1 || m_telemetry_block_records > 4096)
+        throw std::invalid_argument(
+            "telemetry_block_records should have a value between 1 and 4096");
+    }
+
+    if (!m_capture && option == capture_duration_ms) {
+      int arg;
+      tokenize >> arg;
+      m_capture_duration = std::chrono::milliseconds(arg);
+    }
+
+    if (m_capture_output.empty() && option == capture_output)
+      tokenize >> m_capture_output;
+
+    if (m_capture_format.empty() && option == capture_format)
+      tokenize >> m_capture_format;
+
+    // Not while replaying, the trace in the config is likely the one being
+    // replayed.
+    if (m_i2c_trace.empty() && m_replay_trace.empty() && option == i2c_trace)
+      tokenize >> m_i2c_trace;
+
+    if (option == i2c_timeout_ms) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 10 || arg > 1000)
+        throw std::invalid_argument(
+            "i2c_timeout_ms should have a value between 10 and 1000");
+
+      m_i2c_timeout = std::chrono::milliseconds(arg);
+    }
+
+    if (option == i2c_retries) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 0 || arg > 10)
+        throw std::invalid_argument(
+            "i2c_retries should have a value between 0 and 10");
+
+      m_i2c_retry.attempts = arg + 1;
+    }
+
+    if (option == i2c_latency_budget_ms) {
+      int arg;
+      tokenize >> arg;
+      if (arg < 1 || arg > 10000)
+        throw std::invalid_argument(
+            "i2c_latency_budget_ms should have a value between 1 and 10000");
+
+      m_i2c_retry.budget = std::chrono::milliseconds(arg);
+    }
+  }
 
   m_gpio_enabled = !options_to_find.contains(gpio_interrupt_chip) &&
                    !options_to_find.contains(gpio_interrupt_line);
 
-  if (!m_single_run && !m_gpio_enabled &&
+  if (!m_single_run && !m_capture && !m_gpio_enabled &&
       options_to_find.contains(poll_interval))
     throw std::logic_error("Both poll_interval and GPIO interrupts are "
                            "disabled, unable to continue");
 
-  m_power_off_on_low_charge =
-      m_low_charge_percent > 0 || m_low_charge_voltage > 0;
+  // The original poweroff policy, spelled as rules.
+  if (m_low_charge_voltage > 0)
+    m_rules.add("discharging and not charging and battery_voltage_mv < " +
+                std::to_string(m_low_charge_voltage) + " -> poweroff");
+
+  if (m_low_charge_percent > 0)
+    m_rules.add("discharging and not charging and charge_percent < " +
+                std::to_string(m_low_charge_percent) + " -> poweroff");
 }
 
 config::config(int argc, const char **argv) {
   read_cli_args(argc, argv);
 
-  if (m_single_run && !m_i2c_dev_path.empty())
+  if (m_discover || m_archive_benchmark || m_bytes_benchmark ||
+      m_rules_benchmark || m_async_benchmark || !m_export_archive.empty() ||
+      !m_energy_query.empty())
+    return;
+
+  // The rated capacity comes from the config, if there is one.
+  if (!m_health_query.empty()) {
+    if (std::filesystem::exists(m_conf_path))
+      read_config_file();
     return;
+  }
+
+  // A soak runs the daemon's own loop, with the daemon's own config.
+  if (!(m_single_run || m_capture || m_adc_benchmark) || m_soak_cycles ||
+      m_i2c_dev_path.empty())
+    read_config_file();
+
+  if (m_capture_duration.count() != 0 &&
+      (m_capture_duration.count() < 1 ||
+       m_capture_duration > burst_capture::max_duration))
+    throw std::invalid_argument(
+        "Capture duration should be between 1 and " +
+        std::to_string(burst_capture::max_duration.count()) + " ms");
+
+  if (m_capture && m_capture_duration.count() == 0)
+    throw std::invalid_argument("Capture duration should be greater than 0");
 
-  read_config_file();
+  if (!m_capture_format.empty() && m_capture_format != "csv" &&
+      m_capture_format != "bin")
+    throw std::invalid_argument("Capture format should be one of: csv, bin");
+
+  // Empty until here, so the command line wins over the config file.
+  if (m_capture_output.empty())
+    m_capture_output = "-";
 }
 
 std::filesystem::path config::get_conf_path() const { return m_conf_path; }
@@ -172,6 +749,38 @@ std::filesystem::path config::get_i2c_dev_path() const {
 
 bool config::get_single_run() const { return m_single_run; }
 
+bool config::get_discover() const { return m_discover; }
+
+bool config::get_print_stats() const { return m_print_stats; }
+
+bool config::get_jitter_check() const { return m_jitter_check; }
+
+std::filesystem::path config::get_export_archive() const {
+  return m_export_archive;
+}
+
+bool config::get_archive_benchmark() const { return m_archive_benchmark; }
+
+bool config::get_bytes_benchmark() const { return m_bytes_benchmark; }
+
+bool config::get_rules_benchmark() const { return m_rules_benchmark; }
+
+bool config::get_adc_benchmark() const { return m_adc_benchmark; }
+
+std::chrono::milliseconds config::get_i2c_timeout() const {
+  return m_i2c_timeout;
+}
+
+i2c::retry_policy config::get_i2c_retry_policy() const { return m_i2c_retry; }
+
+bool config::get_async_benchmark() const { return m_async_benchmark; }
+
+bool config::get_i2c_dev_auto() const { return m_i2c_dev_path == i2c_dev_auto; }
+
+void config::set_i2c_dev_path(const std::filesystem::path &path) {
+  m_i2c_dev_path = path;
+}
+
 std::string config::get_gpio_chip() const { return m_gpio_chip; }
 
 bool config::get_gpio_enabled() const { return m_gpio_enabled; }
@@ -182,10 +791,111 @@ std::chrono::seconds config::get_poll_interval() const {
   return m_poll_interval;
 }
 
-bool config::get_power_off_on_low_charge() const {
-  return m_power_off_on_low_charge;
+const rules::program &config::get_rules() const { return m_rules; }
+
+std::filesystem::path config::get_poweroff_command(bool simulated) const {
+  return simulated ? m_simulated_poweroff_command : m_poweroff_command;
+}
+
+std::chrono::milliseconds config::get_poweroff_deadline() const {
+  return m_poweroff_deadline;
+}
+
+std::filesystem::path
+config::get_pre_shutdown_hooks_dir(bool simulated) const {
+  if (simulated && !m_simulated_pre_shutdown_hooks)
+    return {};
+
+  return m_pre_shutdown_hooks_dir;
+}
+
+std::chrono::milliseconds config::get_pre_shutdown_hook_timeout() const {
+  return m_pre_shutdown_hook_timeout;
+}
+
+uint config::get_battery_capacity() const { return m_battery_capacity; }
+
+realtime::policy config::get_realtime_policy() const {
+  return m_realtime_policy;
+}
+
+int config::get_realtime_priority() const { return m_realtime_priority; }
+
+bool config::get_lock_memory() const { return m_lock_memory; }
+
+int config::get_cpu_affinity() const { return m_cpu_affinity; }
+
+bool config::get_low_power() const { return m_low_power; }
+
+std::chrono::milliseconds config::get_timer_slack() const {
+  return m_timer_slack;
+}
+
+filter::settings config::get_voltage_filter() const {
+  filter::settings s;
+  s.median_window = m_filter_median_window;
+  s.ewma_shift = m_filter_ewma_shift;
+  s.outlier_limit = m_filter_outlier_mv;
+  return s;
+}
+
+filter::settings config::get_current_filter() const {
+  filter::settings s;
+  s.median_window = m_filter_median_window;
+  s.ewma_shift = m_filter_ewma_shift;
+  s.outlier_limit = m_filter_outlier_ma;
+  return s;
+}
+
+std::filesystem::path config::get_telemetry_archive() const {
+  return m_telemetry_archive;
+}
+
+uint config::get_telemetry_block_records() const {
+  return m_telemetry_block_records;
+}
+
+std::filesystem::path config::get_energy_ledger() const {
+  return m_energy_ledger;
+}
+
+std::chrono::seconds config::get_energy_flush_interval() const {
+  return m_energy_flush_interval;
+}
+
+std::filesystem::path config::get_energy_query() const {
+  return m_energy_query;
+}
+
+std::filesystem::path config::get_battery_health() const {
+  return m_battery_health;
+}
+
+std::filesystem::path config::get_health_query() const {
+  return m_health_query;
+}
+
+bool config::get_capture() const { return m_capture; }
+
+std::chrono::milliseconds config::get_capture_duration() const {
+  return m_capture_duration;
+}
+
+const std::filesystem::path &config::get_capture_output() const {
+  return m_capture_output;
+}
+
+burst_capture::format config::get_capture_format() const {
+  return m_capture_format == "bin" ? burst_capture::format::BINARY
+                                   : burst_capture::format::CSV;
+}
+
+std::filesystem::path config::get_i2c_trace() const { return m_i2c_trace; }
+
+std::filesystem::path config::get_replay_trace() const {
+  return m_replay_trace;
 }
 
-uint config::get_low_charge_voltage() const { return m_low_charge_voltage; }
+unsigned config::get_replay_speed() const { return m_replay_speed; }
 
-uint config::get_low_charge_percent() const { return m_low_charge_percent; }
+unsigned config::get_soak_cycles() const { return m_soak_cycles; }
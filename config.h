@@ -1,5 +1,11 @@
 #pragma once
 
+#include "capture.h"
+#include "filter.h"
+#include "i2c.h"
+#include "realtime.h"
+#include "rules.h"
+
 #include <chrono>
 #include <filesystem>
 #include <string>
@@ -9,6 +15,15 @@ class config {
   std::filesystem::path m_i2c_dev_path{};
 
   bool m_single_run = false;
+  bool m_discover = false;
+  bool m_print_stats = false;
+  bool m_jitter_check = false;
+  std::filesystem::path m_export_archive{};
+  bool m_archive_benchmark = false;
+  bool m_bytes_benchmark = false;
+  bool m_rules_benchmark = false;
+  bool m_adc_benchmark = false;
+  bool m_async_benchmark = false;
 
   std::string m_gpio_chip;
   uint m_gpio_line = 0;
@@ -18,7 +33,51 @@ class config {
 
   int m_low_charge_voltage = 0;
   int m_low_charge_percent = 0;
-  bool m_power_off_on_low_charge = false;
+  rules::program m_rules;
+  std::filesystem::path m_poweroff_command{"/sbin/poweroff"};
+  std::chrono::milliseconds m_poweroff_deadline{3000};
+
+  std::filesystem::path m_pre_shutdown_hooks_dir{};
+  std::chrono::milliseconds m_pre_shutdown_hook_timeout{10000};
+  std::filesystem::path m_simulated_poweroff_command{};
+  bool m_simulated_pre_shutdown_hooks = false;
+  uint m_battery_capacity = 2000;
+
+  realtime::policy m_realtime_policy = realtime::policy::OTHER;
+  int m_realtime_priority = 50;
+  bool m_lock_memory = false;
+  int m_cpu_affinity = -1;
+  bool m_low_power = false;
+  std::chrono::milliseconds m_timer_slack{100};
+
+  unsigned m_filter_median_window = 1;
+  unsigned m_filter_ewma_shift = 0;
+  unsigned m_filter_outlier_mv = 0;
+  unsigned m_filter_outlier_ma = 0;
+
+  std::filesystem::path m_telemetry_archive{};
+  uint m_telemetry_block_records = 64;
+
+  std::filesystem::path m_energy_ledger{};
+  std::chrono::seconds m_energy_flush_interval{300};
+  std::filesystem::path m_energy_query{};
+
+  std::filesystem::path m_battery_health{};
+  std::filesystem::path m_health_query{};
+
+  bool m_capture = false;
+  std::chrono::milliseconds m_capture_duration{0};
+  std::filesystem::path m_capture_output{};
+  std::string m_capture_format{};
+
+  std::filesystem::path m_i2c_trace{};
+  std::filesystem::path m_replay_trace{};
+  unsigned m_replay_speed = 0;
+
+  unsigned m_soak_cycles = 0;
+
+  std::chrono::milliseconds m_i2c_timeout{0};
+  i2c::retry_policy m_i2c_retry{};
 
   void read_cli_args(int argc, const char **argv);
   void read_config_file();
@@ -30,6 +89,23 @@ public:
   std::filesystem::path get_i2c_dev_path() const;
 
   bool get_single_run() const;
+  bool get_discover() const;
+  bool get_print_stats() const;
+  bool get_jitter_check() const;
+  /// Archive to print as CSV, empty if none.
+  std::filesystem::path get_export_archive() const;
+  bool get_archive_benchmark() const;
+  bool get_bytes_benchmark() const;
+  bool get_rules_benchmark() const;
+  bool get_adc_benchmark() const;
+  bool get_async_benchmark() const;
+
+  /**
+   * True if the i2c device should be located by bus discovery, i.e. it was
+   * set to "auto" in the config file or on the command line.
+   */
+  bool get_i2c_dev_auto() const;
+  void set_i2c_dev_path(const std::filesystem::path &path);
 
   std::string get_gpio_chip() const;
   bool get_gpio_enabled() const;
@@ -37,7 +113,70 @@ public:
 
   std::chrono::seconds get_poll_interval() const;
 
-  bool get_power_off_on_low_charge() const;
-  uint get_low_charge_voltage() const;
-  uint get_low_charge_percent() const;
+  /**
+   * Rules from the config, followed by the ones low_charge_voltage_mv and
+   * low_charge_percent stand for.
+   */
+  const rules::program &get_rules() const;
+  /**
+   * Command poweroff rules run. Against a simulator or a replay that's
+   * simulated_poweroff_command, never poweroff_command: empty unless set.
+   */
+  std::filesystem::path get_poweroff_command(bool simulated) const;
+  std::chrono::milliseconds get_poweroff_deadline() const;
+
+  /// Empty against a simulator or a replay, unless simulated_pre_shutdown_hooks
+  /// opts in.
+  std::filesystem::path get_pre_shutdown_hooks_dir(bool simulated) const;
+  std::chrono::milliseconds get_pre_shutdown_hook_timeout() const;
+  uint get_battery_capacity() const;
+
+  realtime::policy get_realtime_policy() const;
+  int get_realtime_priority() const;
+  bool get_lock_memory() const;
+  /// CPU to pin the daemon to, -1 if not pinned.
+  int get_cpu_affinity() const;
+  bool get_low_power() const;
+  /// Timer slack in low power mode.
+  std::chrono::milliseconds get_timer_slack() const;
+
+  /// Filters of the voltage and of the current channels.
+  filter::settings get_voltage_filter() const;
+  filter::settings get_current_filter() const;
+
+  /// Archive to append telemetry to, empty if disabled.
+  std::filesystem::path get_telemetry_archive() const;
+  uint get_telemetry_block_records() const;
+
+  /// Energy ledger to keep, empty if none.
+  std::filesystem::path get_energy_ledger() const;
+  std::chrono::seconds get_energy_flush_interval() const;
+  /// Ledger to print the totals of, from --energy.
+  std::filesystem::path get_energy_query() const;
+
+  /// Battery health record to keep, empty if none.
+  std::filesystem::path get_battery_health() const;
+  /// Record to print, from --health.
+  std::filesystem::path get_health_query() const;
+
+  /// True if a capture was requested on the command line.
+  bool get_capture() const;
+  /// Capture duration, zero if captures are not configured.
+  std::chrono::milliseconds get_capture_duration() const;
+  /// Where captures go, "-" for stdout.
+  const std::filesystem::path &get_capture_output() const;
+  burst_capture::format get_capture_format() const;
+
+  /// Trace to record i2c transactions into, empty if not recording.
+  std::filesystem::path get_i2c_trace() const;
+  /// Trace to play back instead of talking to the device, empty if none.
+  std::filesystem::path get_replay_trace() const;
+  /// How many times faster than recorded to replay, 0 for no waiting.
+  unsigned get_replay_speed() const;
+  /// Cycles to run back to back against the simulator, 0 if not soaking.
+  unsigned get_soak_cycles() const;
+
+  /// Limit for a single i2c transaction, 0 to leave it to the driver.
+  std::chrono::milliseconds get_i2c_timeout() const;
+  i2c::retry_policy get_i2c_retry_policy() const;
 };
@@ -0,0 +1,91 @@
+#include "discovery.h"
+#include "sw6106.h"
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace discovery {
+
+static const std::string adapter_prefix = "i2c-";
+
+static unsigned bus_number(const fs::path &adapter) {
+  return std::stoul(adapter.filename().string().substr(adapter_prefix.size()));
+}
+
+std::vector<fs::path> list_adapters(const fs::path &dev_dir) {
+  std::vector<fs::path> adapters;
+  std::error_code ec;
+
+  for (const auto &entry : fs::directory_iterator(dev_dir, ec)) {
+    const std::string name = entry.path().filename().string();
+    if (!name.starts_with(adapter_prefix) ||
+        name.size() == adapter_prefix.size() ||
+        name.find_first_not_of("0123456789", adapter_prefix.size()) !=
+            std::string::npos)
+      continue;
+
+    adapters.push_back(entry.path());
+  }
+
+  std::sort(adapters.begin(), adapters.end(),
+            [](const fs::path &a, const fs::path &b) {
+              return bus_number(a) < bus_number(b);
+            });
+
+  return adapters;
+}
+
+static unsigned probe(const fs::path &adapter,
+                      std::chrono::milliseconds timeout) {
+  try {
+    auto controller = std::make_shared<i2c::controller>(adapter);
+    controller->open();
+    controller->set_timeout(timeout);
+    controller->set_retry_policy(i2c::retry_policy::none());
+
+    sw6106 psu(controller);
+    return psu.get_chip_version();
+  } catch (std::exception &) {
+    // Nothing at 0x3c, no permissions or not an i2c adapter at all.
+    return 0;
+  }
+}
+
+std::vector<device> find_sw6106(std::chrono::milliseconds per_bus_timeout,
+                                const fs::path &dev_dir) {
+  const auto adapters = list_adapters(dev_dir);
+
+  std::vector<std::future<unsigned>> probes;
+  probes.reserve(adapters.size());
+
+  for (const auto &adapter : adapters) {
+    // Threads are detached rather than joined: a probe stuck in the driver
+    // must not hold back the result. The promise outlives the caller if
+    // needed, so late probes have somewhere to put their answer.
+    std::packaged_task<unsigned()> task(
+        [adapter, per_bus_timeout] { return probe(adapter, per_bus_timeout); });
+    probes.push_back(task.get_future());
+    std::thread(std::move(task)).detach();
+  }
+
+  // All buses are probed simultaneously, so they share a single deadline.
+  // Give the kernel timeout a chance to fire before giving up on a bus.
+  const auto deadline = std::chrono::steady_clock::now() + per_bus_timeout * 2;
+
+  std::vector<device> found;
+  for (size_t i = 0; i < probes.size(); ++i) {
+    if (probes[i].wait_until(deadline) != std::future_status::ready)
+      continue;
+
+    const unsigned version = probes[i].get();
+    if (version == sw6106::expected_chip_version)
+      found.push_back({adapters[i], version});
+  }
+
+  return found;
+}
+
+} // namespace discovery
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+// Locate SW6106 devices without knowing which adapter they are wired to.
+
+namespace discovery {
+
+namespace fs = std::filesystem;
+
+struct device {
+  fs::path adapter;
+  unsigned chip_version = 0;
+};
+
+/**
+ * List i2c adapter files (i2c-N) found in a directory, ordered by bus number.
+ */
+std::vector<fs::path> list_adapters(const fs::path &dev_dir = "/dev");
+
+/**
+ * Probe every adapter in parallel for a SW6106 and return the ones where it
+ * answers with a valid chip version. Each probe is bounded by the kernel
+ * transaction timeout and by the wall clock deadline, so a hung or
+ * clock-stretched bus can't stall the whole scan. Buses that miss the
+ * deadline are reported as empty.
+ * @param per_bus_timeout how long a single bus may take to answer.
+ */
+std::vector<device>
+find_sw6106(std::chrono::milliseconds per_bus_timeout =
+                std::chrono::milliseconds(20),
+            const fs::path &dev_dir = "/dev");
+
+} // namespace discovery
@@ -0,0 +1,207 @@
+#include "energy.h"
+#include "byte_util.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace energy {
+
+// "SW6E", u16 version, u16 totals count, i64 created, i64 updated, then the
+// totals as u64 nJ, all little endian.
+static const bytes::byte magic[] = {'S', 'W', '6', 'E'};
+static const uint16_t version = 1;
+static const size_t file_size = 4 + 2 + 2 + 8 + 8 + port_count * 2 * 8;
+
+using file_image = std::array<bytes::byte, file_size>;
+
+static void encode(const totals &t, file_image &image) {
+  bytes::view<bytes::byte> out(image, bytes::endian::little);
+  for (const bytes::byte b : magic)
+    out << b;
+  out << version << static_cast<uint16_t>(t.nj.size())
+      << static_cast<int64_t>(t.created) << static_cast<int64_t>(t.updated);
+  out.write(std::span<const uint64_t>(t.nj));
+}
+
+static size_t index(port p, direction d) {
+  return static_cast<size_t>(p) * 2 + static_cast<size_t>(d);
+}
+
+static bool has(sw6106::system_status status, sw6106::system_status flag) {
+  return static_cast<uint32_t>(status) & static_cast<uint32_t>(flag);
+}
+
+ledger::ledger(const std::filesystem::path &path,
+               std::chrono::seconds flush_interval)
+    : m_file(path), m_flush_interval(flush_interval),
+      m_flushed(std::chrono::steady_clock::now()) {
+  if (std::filesystem::exists(path))
+    m_totals = read(path);
+}
+
+ledger::~ledger() {
+  if (m_dirty)
+    flush();
+}
+
+void ledger::add(const sample &s) {
+  using namespace std::chrono;
+
+  if (m_have_previous && s.timestamp > m_previous) {
+    const auto ms = duration_cast<milliseconds>(s.timestamp - m_previous);
+
+    // The sub-millisecond rest is carried over to the next sample.
+    m_previous += ms;
+    for (size_t i = 0; i < m_power_uw.size(); ++i)
+      m_totals.nj[i] += m_power_uw[i] * ms.count();
+
+    m_dirty = true;
+  } else if (!m_have_previous) {
+    m_previous = s.timestamp;
+    m_have_previous = true;
+  }
+
+  if (m_totals.created == 0)
+    m_totals.created = s.wall_time;
+  m_totals.updated = s.wall_time;
+
+  // The power from now until the next sample.
+  m_power_uw.fill(0);
+  const auto status = s.data.status;
+  using flag = sw6106::system_status;
+
+  port charger = port::UNATTRIBUTED;
+  if (s.charging) {
+    if (has(status, flag::PORT_MICRO_CONNECTED))
+      charger = port::MICRO;
+    else if (has(status, flag::PORT_C_CONNECTED))
+      charger = port::C;
+
+    m_power_uw[index(charger, direction::IN)] =
+        uint64_t(s.data.battery_voltage_mv) * s.data.charge_current_ma;
+  }
+
+  if (s.discharging) {
+    port outputs[2];
+    size_t count = 0;
+    if (has(status, flag::PORT_A_CONNECTED))
+      outputs[count++] = port::A;
+    if (has(status, flag::PORT_C_CONNECTED) &&
+        !(s.charging && charger == port::C))
+      outputs[count++] = port::C;
+    if (count == 0)
+      outputs[count++] = port::UNATTRIBUTED;
+
+    const uint64_t power =
+        uint64_t(s.data.output_voltage_mv) * s.data.discharge_current_ma;
+    for (size_t i = 0; i < count; ++i)
+      m_power_uw[index(outputs[i], direction::OUT)] = power / count;
+  }
+
+  if (m_dirty && steady_clock::now() - m_flushed >= m_flush_interval)
+    flush();
+}
+
+void ledger::flush() {
+  m_flushed = std::chrono::steady_clock::now();
+  m_dirty = false;
+
+  file_image image;
+  encode(m_totals, image);
+
+  if (!m_file.write(image))
+    text::err() << "Failed to write energy ledger: " << strerror(errno)
+                << text::endl;
+}
+
+totals read(const std::filesystem::path &path) {
+  // One more than needed, to tell a longer file apart.
+  std::array<bytes::byte, file_size + 1> image;
+  if (read_state_file(path, image) != file_size ||
+      std::memcmp(image.data(), magic, sizeof(magic)) != 0)
+    throw std::runtime_error(path.generic_string() +
+                             " is not an energy ledger");
+
+  bytes::view<const bytes::byte> in(
+      std::span<const bytes::byte>(image.data(), file_size),
+      bytes::endian::little);
+  in.seek(sizeof(magic));
+
+  uint16_t file_version, count;
+  int64_t created, updated;
+  in >> file_version >> count >> created >> updated;
+  if (file_version != version || count != port_count * 2)
+    throw std::runtime_error(path.generic_string() +
+                             " is an energy ledger of an unknown version");
+
+  totals t;
+  t.created = created;
+  t.updated = updated;
+  in.read(std::span<uint64_t>(t.nj));
+
+  return t;
+}
+
+// 1 mWh is 3.6 J.
+static void print_mwh(text::writer &out, uint64_t nj) {
+  const uint64_t uwh = nj / 3600000;
+  const uint64_t thousandths = uwh % 1000;
+
+  out << uwh / 1000 << '.';
+  if (thousandths < 100)
+    out << '0';
+  if (thousandths < 10)
+    out << '0';
+  out << thousandths << " mWh";
+}
+
+static void print_time(text::writer &out, std::time_t t) {
+  tm local;
+  localtime_r(&t, &local);
+
+  char time[32];
+  strftime(time, sizeof(time), "%F %T", &local);
+  out << time;
+}
+
+void print(text::writer &out, const totals &t) {
+  static const char *names[port_count] = {"port A", "port Micro", "port C",
+                                          "unattributed"};
+
+  if (t.created == 0) {
+    out << "No energy recorded yet" << text::endl;
+    return;
+  }
+
+  out << "Since ";
+  print_time(out, t.created);
+  out << ", last updated ";
+  print_time(out, t.updated);
+  out << '\n';
+
+  uint64_t in = 0, out_total = 0;
+  for (size_t p = 0; p < port_count; ++p) {
+    const uint64_t charged = t.get(static_cast<port>(p), direction::IN);
+    const uint64_t discharged = t.get(static_cast<port>(p), direction::OUT);
+    in += charged;
+    out_total += discharged;
+
+    if (charged == 0 && discharged == 0)
+      continue;
+
+    out << names[p] << ": in ";
+    print_mwh(out, charged);
+    out << ", out ";
+    print_mwh(out, discharged);
+    out << '\n';
+  }
+
+  out << "total: in ";
+  print_mwh(out, in);
+  out << ", out ";
+  print_mwh(out, out_total);
+  out << text::endl;
+}
+
+} // namespace energy
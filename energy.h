@@ -0,0 +1,92 @@
+#pragma once
+
+#include "report.h"
+#include "state_file.h"
+#include "text.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+#include <string>
+
+// Energy accounting per port and direction, for billing and planning.
+//
+// Power is held from one sample to the next and integrated over CLOCK_MONOTONIC
+// time in whole milliseconds: mV * mA * ms is exactly nJ, so the totals are
+// plain integers that never lose a fraction. Energy in is measured on the
+// battery side (battery voltage times charge current) and booked to the port
+// the charger is on, energy out at the output (output voltage times discharge
+// current) and split evenly between the output ports in use, the chip doesn't
+// tell them apart. Whatever can't be attributed to a port is booked as such.
+//
+// The totals are kept in a state_file.
+
+namespace energy {
+
+enum class port : uint8_t { A, MICRO, C, UNATTRIBUTED };
+enum class direction : uint8_t { IN, OUT };
+
+static constexpr size_t port_count = 4;
+
+struct totals {
+  /// Nanojoules, indexed by port * 2 + direction.
+  std::array<uint64_t, port_count * 2> nj{};
+  std::time_t created = 0; // wall time of the first sample
+  std::time_t updated = 0; // wall time of the last one
+
+  uint64_t get(port p, direction d) const {
+    return nj[static_cast<size_t>(p) * 2 + static_cast<size_t>(d)];
+  }
+};
+
+class ledger {
+  state_file m_file;
+  totals m_totals;
+
+  // Power held since the previous sample, in uW, indexed like the totals.
+  std::array<uint64_t, port_count * 2> m_power_uw{};
+  bool m_have_previous = false;
+  std::chrono::steady_clock::time_point m_previous;
+
+  std::chrono::steady_clock::duration m_flush_interval;
+  std::chrono::steady_clock::time_point m_flushed;
+  bool m_dirty = false;
+
+public:
+  /**
+   * Carry on with the totals in the file, or start from zero if there is
+   * none yet.
+   * @param flush_interval longest time totals are kept in memory only.
+   */
+  ledger(const std::filesystem::path &path,
+         std::chrono::seconds flush_interval);
+  /// Writes out what's pending.
+  ~ledger();
+
+  ledger(const ledger &) = delete;
+  ledger &operator=(const ledger &) = delete;
+
+  /// Account for the time since the previous sample. Constant time, writes
+  /// the file once the flush interval has passed.
+  void add(const sample &s);
+
+  /// Write the totals out now. Doesn't throw, failures are logged.
+  void flush();
+
+  const totals &get_totals() const { return m_totals; }
+};
+
+/**
+ * Read the totals of a ledger file.
+ * @throw std::runtime_error if it can't be read or isn't a ledger.
+ */
+totals read(const std::filesystem::path &path);
+
+/**
+ * Print the totals in mWh, per port and direction.
+ */
+void print(text::writer &out, const totals &t);
+
+} // namespace energy
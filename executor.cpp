@@ -0,0 +1,131 @@
+#include "executor.h"
+
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace async {
+
+executor::executor(i2c::controller::ptr controller)
+    : m_controller(std::move(controller)) {
+  m_event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_event_fd < 0)
+    throw std::runtime_error(std::string("Failed to create an eventfd: ") +
+                             strerror(errno));
+
+  m_thread = std::thread(&executor::loop, this);
+}
+
+executor::~executor() {
+  {
+    std::lock_guard lock(m_lock);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+
+  close(m_event_fd);
+}
+
+void executor::submit(operation *op) {
+  op->next = nullptr;
+
+  {
+    std::lock_guard lock(m_lock);
+    if (m_queued_tail)
+      m_queued_tail->next = op;
+    else
+      m_queued = op;
+    m_queued_tail = op;
+  }
+
+  m_wake.notify_one();
+}
+
+void executor::loop() {
+  std::unique_lock lock(m_lock);
+
+  while (true) {
+    m_wake.wait(lock, [this] { return m_queued || m_stop; });
+    if (!m_queued)
+      break;
+
+    // Everything queued so far is run as one batch, which costs a single
+    // wakeup on either side however many operations are in flight.
+    operation *first = m_queued, *last = m_queued_tail;
+    m_queued = m_queued_tail = nullptr;
+
+    lock.unlock();
+    for (operation *op = first;; op = op->next) {
+      op->run();
+      if (op == last)
+        break;
+    }
+    lock.lock();
+
+    if (m_completed_tail)
+      m_completed_tail->next = first;
+    else
+      m_completed = first;
+    m_completed_tail = last;
+
+    const uint64_t one = 1;
+    if (::write(m_event_fd, &one, sizeof(one)) < 0) {
+      // Only fails if the counter is about to overflow, it's readable then.
+    }
+  }
+}
+
+void executor::wait() {
+  pollfd p{m_event_fd, POLLIN, 0};
+  while (poll(&p, 1, -1) < 0 && errno == EINTR)
+    ;
+}
+
+size_t executor::dispatch() {
+  uint64_t count;
+  if (::read(m_event_fd, &count, sizeof(count)) < 0)
+    return 0;
+
+  operation *op;
+  {
+    std::lock_guard lock(m_lock);
+    op = m_completed;
+    m_completed = m_completed_tail = nullptr;
+  }
+
+  size_t resumed = 0;
+  while (op) {
+    // The waiter may finish and free the operation when resumed.
+    operation *next = op->next;
+    op->waiter.resume();
+    op = next;
+    ++resumed;
+  }
+
+  return resumed;
+}
+
+task<sw6106::snapshot> psu::snapshot() {
+  co_return co_await m_executor.run([this] { return m_device.get_snapshot(); });
+}
+
+task<sw6106::system_status> psu::status() {
+  co_return co_await m_executor.run(
+      [this] { return m_device.get_system_status(); });
+}
+
+task<sw6106::adc_reading> psu::adc(sw6106::adc_channels channels) {
+  co_return co_await m_executor.run(
+      [this, channels] { return m_device.read_adc(channels); });
+}
+
+task<sw6106::interrupt_event> psu::interrupts(std::chrono::nanoseconds edge) {
+  co_return co_await m_executor.run(
+      [this, edge] { return m_device.read_interrupts(edge); });
+}
+
+} // namespace async
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "i2c.h"
+#include "sw6106.h"
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+// Asynchronous access to an i2c controller, for code that mustn't stall
+// behind a slow or clock stretched bus.
+//
+// An executor owns a thread that runs every transaction on its controller,
+// one queued operation after another. Coroutines co_await the operations
+// and are resumed on the thread that owns the executor, by dispatch(), once
+// they're done. fd() becomes readable then, so an event loop can poll it
+// along with its sockets and timers:
+//
+//   async::task<unsigned> charge(async::psu &psu) {
+//     const auto s = co_await psu.snapshot();
+//     co_return s.charge_percent;
+//   }
+//
+// Operations from any number of coroutines may be in flight at once, the bus
+// thread works through them in order. Queueing itself doesn't allocate,
+// coroutine frames do.
+
+namespace async {
+
+template <typename T> class task;
+
+namespace detail {
+
+struct promise_base {
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+  bool started = false;
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      return h.promise().continuation;
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T> struct promise : promise_base {
+  std::optional<T> value;
+
+  task<T> get_return_object();
+  void return_value(T v) { value.emplace(std::move(v)); }
+};
+
+template <> struct promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+};
+
+} // namespace detail
+
+/**
+ * A coroutine that starts when awaited, or when start() is called.
+ */
+template <typename T> class task {
+public:
+  using promise_type = detail::promise<T>;
+
+private:
+  std::coroutine_handle<promise_type> m_handle;
+
+public:
+  explicit task(std::coroutine_handle<promise_type> h) : m_handle(h) {}
+  task(task &&other) noexcept : m_handle(std::exchange(other.m_handle, {})) {}
+  task &operator=(task &&other) noexcept {
+    if (this != &other) {
+      if (m_handle)
+        m_handle.destroy();
+      m_handle = std::exchange(other.m_handle, {});
+    }
+    return *this;
+  }
+  ~task() {
+    if (m_handle)
+      m_handle.destroy();
+  }
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+
+  /**
+   * Run the coroutine up to its first suspension, typically until its first
+   * operation is queued. Lets several tasks share the bus.
+   */
+  void start() {
+    m_handle.promise().started = true;
+    m_handle.resume();
+  }
+
+  bool started() const { return m_handle.promise().started; }
+  bool done() const { return m_handle.done(); }
+
+  /// The value of a finished task, or its exception rethrown.
+  T result() {
+    auto &p = m_handle.promise();
+    if (p.error)
+      std::rethrow_exception(p.error);
+
+    if constexpr (!std::is_void_v<T>)
+      return std::move(*p.value);
+  }
+
+  bool await_ready() const { return started() && done(); }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    m_handle.promise().continuation = awaiting;
+    if (started())
+      return std::noop_coroutine();
+
+    m_handle.promise().started = true;
+    return m_handle;
+  }
+
+  T await_resume() { return result(); }
+};
+
+template <typename T> task<T> detail::promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> detail::promise<void>::get_return_object() {
+  return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+class executor {
+public:
+  /**
+   * Work for the bus thread. Lives in the awaiting coroutine's frame.
+   */
+  struct operation {
+    operation *next = nullptr;
+    std::coroutine_handle<> waiter;
+
+    /// Called on the bus thread, must not throw.
+    virtual void run() noexcept = 0;
+
+  protected:
+    ~operation() = default;
+  };
+
+private:
+  i2c::controller::ptr m_controller;
+
+  std::mutex m_lock;
+  std::condition_variable m_wake;
+  // Intrusive FIFOs, nothing is allocated per operation.
+  operation *m_queued = nullptr, *m_queued_tail = nullptr;
+  operation *m_completed = nullptr, *m_completed_tail = nullptr;
+  bool m_stop = false;
+
+  int m_event_fd = -1;
+  std::thread m_thread;
+
+  void loop();
+
+public:
+  /**
+   * Start the bus thread. Nothing else should use the controller for as
+   * long as the executor exists.
+   */
+  explicit executor(i2c::controller::ptr controller);
+  /// Finishes the queued operations first, without resuming their waiters.
+  ~executor();
+
+  executor(const executor &) = delete;
+  executor &operator=(const executor &) = delete;
+
+  /// Queue an operation. Safe from any thread.
+  void submit(operation *op);
+
+  /// Readable while completed operations wait for dispatch().
+  int fd() const { return m_event_fd; }
+
+  /// Block until an operation completes, or return at once if one has.
+  void wait();
+
+  /**
+   * Resume the coroutines whose operations have completed, on the calling
+   * thread. Meant for the thread that owns the executor.
+   * @return number of coroutines resumed.
+   */
+  size_t dispatch();
+
+  template <typename F> class call;
+
+  /**
+   * Run a function on the bus thread, e.g. a few sw6106 calls that belong
+   * together.
+   * @return awaitable for the function's result. Exceptions are rethrown in
+   * the awaiting coroutine.
+   */
+  template <typename F> call<F> run(F f) { return call<F>(*this, std::move(f)); }
+};
+
+template <typename F> class executor::call : public executor::operation {
+  using result_type = std::invoke_result_t<F &>;
+  using stored_type =
+      std::conditional_t<std::is_void_v<result_type>, bool, result_type>;
+
+  executor &m_executor;
+  F m_function;
+  std::optional<stored_type> m_result;
+  std::exception_ptr m_error;
+
+public:
+  call(executor &e, F f) : m_executor(e), m_function(std::move(f)) {}
+
+  void run() noexcept override {
+    try {
+      if constexpr (std::is_void_v<result_type>) {
+        m_function();
+        m_result.emplace(true);
+      } else
+        m_result.emplace(m_function());
+    } catch (...) {
+      m_error = std::current_exception();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    waiter = h;
+    m_executor.submit(this);
+  }
+
+  result_type await_resume() {
+    if (m_error)
+      std::rethrow_exception(m_error);
+
+    if constexpr (!std::is_void_v<result_type>)
+      return std::move(*m_result);
+  }
+};
+
+/**
+ * Run a task to completion from outside of a coroutine, dispatching the
+ * executor meanwhile. Other tasks in flight on it progress as well.
+ */
+template <typename T> T sync_wait(executor &e, task<T> &t) {
+  if (!t.started())
+    t.start();
+
+  while (!t.done()) {
+    e.wait();
+    e.dispatch();
+  }
+
+  return t.result();
+}
+
+template <typename T> T sync_wait(executor &e, task<T> &&t) {
+  return sync_wait(e, t);
+}
+
+/**
+ * sw6106 operations as tasks. Each one is a single operation on the bus, so
+ * the registers it reads are not interleaved with other tasks' transactions.
+ */
+class psu {
+  executor &m_executor;
+  sw6106 &m_device;
+
+public:
+  psu(executor &e, sw6106 &device) : m_executor(e), m_device(device) {}
+
+  task<sw6106::snapshot> snapshot();
+  task<sw6106::system_status> status();
+  task<sw6106::adc_reading>
+  adc(sw6106::adc_channels channels = sw6106::adc_channels::ALL);
+  task<sw6106::interrupt_event> interrupts(std::chrono::nanoseconds edge);
+};
+
+} // namespace async
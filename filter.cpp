@@ -0,0 +1,109 @@
+#include "filter.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace filter {
+
+static const unsigned ewma_fraction_bits = 16;
+
+channel::channel(const settings &s) : m_settings(s) {
+  if (s.median_window < 1 || s.median_window > settings::max_median_window ||
+      s.median_window % 2 == 0)
+    throw std::invalid_argument("Median window should be an odd number "
+                                "between 1 and " +
+                                std::to_string(settings::max_median_window));
+
+  if (s.ewma_shift > 8)
+    throw std::invalid_argument("EWMA shift should be between 0 and 8");
+}
+
+unsigned channel::median() const {
+  // At most 9 values, insertion sort on a copy is as cheap as it gets.
+  std::array<unsigned, settings::max_median_window> sorted;
+  std::copy_n(m_window.begin(), m_window_size, sorted.begin());
+
+  for (unsigned i = 1; i < m_window_size; ++i)
+    for (unsigned j = i; j > 0 && sorted[j - 1] > sorted[j]; --j)
+      std::swap(sorted[j - 1], sorted[j]);
+
+  return sorted[m_window_size / 2];
+}
+
+unsigned channel::push(unsigned raw) {
+  if (m_primed && m_settings.outlier_limit > 0) {
+    const unsigned distance = raw > m_output ? raw - m_output : m_output - raw;
+
+    if (distance > m_settings.outlier_limit) {
+      if (++m_rejections < m_settings.max_rejections) {
+        stats::filter_rejections.add();
+        return m_output;
+      }
+
+      // Not noise, the value really moved. Follow it right away.
+      reset();
+    }
+  }
+
+  m_rejections = 0;
+
+  m_window[m_window_next] = raw;
+  m_window_next = (m_window_next + 1) % m_settings.median_window;
+  m_window_size = std::min(m_window_size + 1, m_settings.median_window);
+
+  const uint64_t median_fp = uint64_t(median()) << ewma_fraction_bits;
+
+  if (!m_primed || m_settings.ewma_shift == 0)
+    m_ewma = median_fp;
+  else if (median_fp >= m_ewma)
+    m_ewma += (median_fp - m_ewma) >> m_settings.ewma_shift;
+  else
+    m_ewma -= (m_ewma - median_fp) >> m_settings.ewma_shift;
+
+  // Round to nearest
+  m_output = (m_ewma + (1ULL << (ewma_fraction_bits - 1))) >> ewma_fraction_bits;
+  m_primed = true;
+
+  return m_output;
+}
+
+void channel::reset() {
+  m_window_size = 0;
+  m_window_next = 0;
+  m_ewma = 0;
+  m_output = 0;
+  m_rejections = 0;
+  m_primed = false;
+}
+
+snapshot_filter::snapshot_filter(const settings &voltage,
+                                 const settings &current)
+    : m_battery_voltage(voltage), m_output_voltage(voltage),
+      m_charge_current(current), m_discharge_current(current) {}
+
+static unsigned push_if(channel &c, bool measured, unsigned raw) {
+  if (measured)
+    return c.push(raw);
+
+  c.reset();
+  return raw;
+}
+
+sw6106::snapshot snapshot_filter::push(const sw6106::snapshot &raw,
+                                       bool charging, bool discharging) {
+  sw6106::snapshot filtered = raw;
+
+  filtered.battery_voltage_mv = push_if(
+      m_battery_voltage, charging || discharging, raw.battery_voltage_mv);
+  filtered.output_voltage_mv =
+      push_if(m_output_voltage, discharging, raw.output_voltage_mv);
+  filtered.charge_current_ma =
+      push_if(m_charge_current, charging, raw.charge_current_ma);
+  filtered.discharge_current_ma =
+      push_if(m_discharge_current, discharging, raw.discharge_current_ma);
+
+  return filtered;
+}
+
+} // namespace filter
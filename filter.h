@@ -0,0 +1,85 @@
+#pragma once
+
+#include "sw6106.h"
+
+#include <array>
+#include <cstdint>
+
+// Noise filtering of ADC readings, so a single bad read can't trigger a
+// poweroff. Integer only, with a fixed upper bound on the work per sample.
+
+namespace filter {
+
+struct settings {
+  static constexpr unsigned max_median_window = 9;
+
+  unsigned median_window = 1; // 1 disables, odd values up to 9
+  unsigned ewma_shift = 0;    // weight of a new value is 1/2^shift, 0 disables
+  unsigned outlier_limit = 0; // max distance from the output, 0 disables
+
+  /**
+   * An outlier that repeats this many times in a row is a real step, not
+   * noise. The channel restarts from it.
+   */
+  unsigned max_rejections = 3;
+
+  bool enabled() const {
+    return median_window > 1 || ewma_shift > 0 || outlier_limit > 0;
+  }
+
+  bool operator==(const settings &) const = default;
+};
+
+/**
+ * Filter of a single channel: outlier rejection, then median of the last
+ * samples, then exponentially weighted moving average.
+ */
+class channel {
+  settings m_settings;
+
+  std::array<unsigned, settings::max_median_window> m_window{};
+  unsigned m_window_size = 0;
+  unsigned m_window_next = 0;
+
+  uint64_t m_ewma = 0; // 16.16 fixed point
+  unsigned m_output = 0;
+  unsigned m_rejections = 0;
+  bool m_primed = false;
+
+  unsigned median() const;
+
+public:
+  channel() = default;
+  explicit channel(const settings &s);
+
+  /**
+   * Feed a raw value.
+   * @return the filtered value.
+   */
+  unsigned push(unsigned raw);
+
+  unsigned value() const { return m_output; }
+
+  /// Forget the history, for when the channel stops being measured.
+  void reset();
+};
+
+/**
+ * One filter per ADC channel of a snapshot. Channels that are not measured
+ * in the current mode are reset, so the history doesn't span mode changes.
+ */
+class snapshot_filter {
+  channel m_battery_voltage;
+  channel m_output_voltage;
+  channel m_charge_current;
+  channel m_discharge_current;
+
+public:
+  snapshot_filter() = default;
+  snapshot_filter(const settings &voltage, const settings &current);
+
+  sw6106::snapshot push(const sw6106::snapshot &raw, bool charging,
+                        bool discharging);
+};
+
+} // namespace filter
@@ -0,0 +1,269 @@
+#include "health.h"
+#include "byte_util.h"
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace health {
+
+// "SW6H", u16 version, u32 cycles, u64 charged uC, u64 discharged uC,
+// u32 capacity uAh, u32 last cycle uAh, u32 resistance uOhm, u32 resistance
+// steps, i64 created, i64 updated, all little endian.
+static const bytes::byte magic[] = {'S', 'W', '6', 'H'};
+static const uint16_t version = 1;
+static const size_t file_size = 4 + 2 + 4 + 8 + 8 + 4 + 4 + 4 + 4 + 8 + 8;
+
+using file_image = std::array<bytes::byte, file_size>;
+
+// Of the boost converter, to get from output to battery current.
+static const unsigned boost_efficiency_percent = 90;
+
+// Anything above is a glitch rather than a cell.
+static const int64_t max_resistance_uohm = 2000000;
+
+// 1 uAh is 3600 uC.
+static const uint64_t uc_per_uah = 3600;
+
+static void encode(const record &r, file_image &image) {
+  bytes::view<bytes::byte> out(image, bytes::endian::little);
+  for (const bytes::byte b : magic)
+    out << b;
+  out << version << r.cycles << r.charged_uc << r.discharged_uc
+      << r.capacity_uah << r.last_cycle_uah << r.resistance_uohm
+      << r.resistance_steps << static_cast<int64_t>(r.created)
+      << static_cast<int64_t>(r.updated);
+}
+
+static bool has(sw6106::interrupts flags, sw6106::interrupts flag) {
+  return static_cast<uint32_t>(flags) & static_cast<uint32_t>(flag);
+}
+
+/**
+ * Battery side current, positive while charging. The charger feeds the
+ * output by itself, so while charging the battery only sees the charge
+ * current.
+ */
+static int battery_current_ma(const sample &s) {
+  const auto &d = s.data;
+  if (s.charging)
+    return d.charge_current_ma;
+
+  if (!s.discharging || d.battery_voltage_mv == 0)
+    return 0;
+
+  const uint64_t output_uw =
+      uint64_t(d.output_voltage_mv) * d.discharge_current_ma;
+  return -static_cast<int>(output_uw * 100 /
+                           (uint64_t(d.battery_voltage_mv) *
+                            boost_efficiency_percent));
+}
+
+tracker::tracker(const std::filesystem::path &path)
+    : m_file(path), m_flushed(std::chrono::steady_clock::now()) {
+  if (std::filesystem::exists(path))
+    m_record = read(path);
+}
+
+tracker::~tracker() {
+  if (m_dirty)
+    flush();
+}
+
+void tracker::integrate(std::chrono::milliseconds held) {
+  const int64_t uc = int64_t(m_current_ma) * held.count();
+  if (uc > 0)
+    m_record.charged_uc += uc;
+  else
+    m_record.discharged_uc -= uc;
+
+  // Net, so a top up halfway through doesn't spoil the cycle.
+  if (m_in_cycle)
+    m_cycle_uc -= uc;
+
+  m_dirty = true;
+}
+
+void tracker::end_cycle() {
+  m_in_cycle = false;
+  if (m_cycle_uc <= 0)
+    return;
+
+  // What's left below 5 % is the other 5 % of the capacity.
+  const uint64_t uah =
+      std::min<uint64_t>(m_cycle_uc / uc_per_uah * 100 / 95, UINT32_MAX);
+
+  m_record.cycles++;
+  m_record.last_cycle_uah = uah;
+  if (m_record.capacity_uah == 0)
+    m_record.capacity_uah = uah;
+  else
+    m_record.capacity_uah +=
+        (int64_t(uah) - int64_t(m_record.capacity_uah)) / 4;
+
+  text::out() << "Battery cycle " << m_record.cycles << " complete: "
+              << uah / 1000 << " mAh, capacity estimate "
+              << m_record.capacity_uah / 1000 << " mAh" << text::endl;
+}
+
+void tracker::measure_resistance(const sample &s, int current_ma,
+                                 std::chrono::steady_clock::duration since) {
+  const unsigned battery_mv = s.data.battery_voltage_mv;
+  const int step = current_ma - m_current_ma;
+
+  // The battery voltage reads 0 when idle.
+  if (since > step_window || std::abs(step) < step_ma || battery_mv == 0 ||
+      m_battery_mv == 0)
+    return;
+
+  // V = OCV + I * R, with OCV the same on both sides of the step.
+  const int64_t uohm =
+      (int64_t(battery_mv) - int64_t(m_battery_mv)) * 1000000 / step;
+  if (uohm <= 0 || uohm > max_resistance_uohm)
+    return;
+
+  m_record.resistance_steps++;
+  if (m_record.resistance_uohm == 0)
+    m_record.resistance_uohm = uohm;
+  else
+    m_record.resistance_uohm +=
+        (uohm - int64_t(m_record.resistance_uohm)) / 8;
+}
+
+void tracker::add(const sample &s) {
+  using namespace std::chrono;
+
+  const auto since = s.timestamp - m_previous;
+  const int current_ma = battery_current_ma(s);
+
+  if (m_have_previous && s.timestamp > m_previous) {
+    const auto ms = duration_cast<milliseconds>(since);
+
+    // The sub-millisecond rest is carried over to the next sample.
+    m_previous += ms;
+    integrate(ms);
+    measure_resistance(s, current_ma, since);
+  } else if (!m_have_previous) {
+    m_previous = s.timestamp;
+    m_have_previous = true;
+  }
+
+  m_current_ma = current_ma;
+  m_battery_mv = s.data.battery_voltage_mv;
+
+  if (m_record.created == 0)
+    m_record.created = s.wall_time;
+  m_record.updated = s.wall_time;
+
+  using irq = sw6106::interrupts;
+  const auto flags = s.interrupts.flags;
+  bool cycle_ended = false;
+  if (has(flags, irq::CHARGE_BELLOW_5_PERCENT) && m_in_cycle) {
+    end_cycle();
+    cycle_ended = true;
+  }
+
+  if (has(flags, irq::FULLY_CHARGED)) {
+    m_in_cycle = true;
+    m_cycle_uc = 0;
+  }
+
+  if (cycle_ended ||
+      (m_dirty && steady_clock::now() - m_flushed >= flush_interval))
+    flush();
+}
+
+void tracker::flush() {
+  m_flushed = std::chrono::steady_clock::now();
+  m_dirty = false;
+
+  file_image image;
+  encode(m_record, image);
+
+  if (!m_file.write(image))
+    text::err() << "Failed to write battery health: " << strerror(errno)
+                << text::endl;
+}
+
+record read(const std::filesystem::path &path) {
+  // One more than needed, to tell a longer file apart.
+  std::array<bytes::byte, file_size + 1> image;
+  if (read_state_file(path, image) != file_size ||
+      std::memcmp(image.data(), magic, sizeof(magic)) != 0)
+    throw std::runtime_error(path.generic_string() +
+                             " is not a battery health file");
+
+  bytes::view<const bytes::byte> in(
+      std::span<const bytes::byte>(image.data(), file_size),
+      bytes::endian::little);
+  in.seek(sizeof(magic));
+
+  uint16_t file_version;
+  in >> file_version;
+  if (file_version != version)
+    throw std::runtime_error(path.generic_string() +
+                             " is a battery health file of an unknown version");
+
+  record r;
+  int64_t created, updated;
+  in >> r.cycles >> r.charged_uc >> r.discharged_uc >> r.capacity_uah >>
+      r.last_cycle_uah >> r.resistance_uohm >> r.resistance_steps >> created >>
+      updated;
+  r.created = created;
+  r.updated = updated;
+
+  return r;
+}
+
+static void print_time(text::writer &out, std::time_t t) {
+  tm local;
+  localtime_r(&t, &local);
+
+  char time[32];
+  strftime(time, sizeof(time), "%F %T", &local);
+  out << time;
+}
+
+void print(text::writer &out, const record &r, unsigned rated_mah) {
+  if (r.created == 0) {
+    out << "No battery health recorded yet" << text::endl;
+    return;
+  }
+
+  out << "Since ";
+  print_time(out, r.created);
+  out << ", last updated ";
+  print_time(out, r.updated);
+  out << '\n';
+
+  // Equivalent full cycles, in tenths, against the best known capacity.
+  const uint64_t capacity_uah =
+      r.capacity_uah ? r.capacity_uah : uint64_t(rated_mah) * 1000;
+  const uint64_t tenths =
+      r.discharged_uc / uc_per_uah * 10 / std::max<uint64_t>(capacity_uah, 1);
+  out << "Cycles: " << r.cycles << " complete, " << tenths / 10 << '.'
+      << tenths % 10 << " equivalent full\n";
+
+  if (r.capacity_uah) {
+    out << "Capacity: " << r.capacity_uah / 1000 << " mAh, "
+        << uint64_t(r.capacity_uah) / 10 / std::max(rated_mah, 1u)
+        << " % of " << rated_mah << " mAh rated, last cycle "
+        << r.last_cycle_uah / 1000 << " mAh\n";
+  } else {
+    out << "Capacity: not measured yet, takes a discharge from full to 5 %\n";
+  }
+
+  if (r.resistance_uohm) {
+    out << "Internal resistance: " << r.resistance_uohm / 1000 << " mOhm from "
+        << r.resistance_steps << " load steps\n";
+  } else {
+    out << "Internal resistance: not measured yet, takes a load step\n";
+  }
+
+  out << "Charged " << r.charged_uc / uc_per_uah / 1000 << " mAh, discharged "
+      << r.discharged_uc / uc_per_uah / 1000 << " mAh" << text::endl;
+}
+
+} // namespace health
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "report.h"
+#include "state_file.h"
+#include "text.h"
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+
+// Battery health from the readings the daemon takes anyway, so packs can be
+// replaced when they wear out rather than on a schedule.
+//
+// The battery side current is counted in whole mA * ms, which is uC, held
+// from one sample to the next like the energy ledger does. While charging
+// that's the charge current, while discharging the output power over the
+// battery voltage and a typical boost efficiency.
+//
+// A cycle runs from FULLY_CHARGED to CHARGE_BELLOW_5_PERCENT: the net charge
+// that left the battery in between is 95 % of its capacity. Each cycle
+// updates a running capacity estimate. Every step in current of at least
+// step_ma between two samples close in time gives an internal resistance
+// reading, the voltage step over the current step, which updates a running
+// resistance estimate. Both are weighted averages, nothing is rescanned.
+//
+// The record is kept in a state_file, one per pack.
+
+namespace health {
+
+/// Smallest current step a resistance reading is taken from.
+static constexpr int step_ma = 300;
+/// Longest time between the two samples of a step, so the open circuit
+/// voltage hasn't moved in between.
+static constexpr std::chrono::seconds step_window{10};
+
+struct record {
+  uint32_t cycles = 0;           // complete cycles
+  uint64_t charged_uc = 0;       // into the battery, ever
+  uint64_t discharged_uc = 0;    // out of the battery, ever
+  uint32_t capacity_uah = 0;     // running estimate, 0 until the first cycle
+  uint32_t last_cycle_uah = 0;   // capacity measured by the last cycle
+  uint32_t resistance_uohm = 0;  // running estimate, 0 until the first step
+  uint32_t resistance_steps = 0; // readings it is made of
+  std::time_t created = 0;       // wall time of the first sample
+  std::time_t updated = 0;       // wall time of the last one
+};
+
+class tracker {
+  state_file m_file;
+  record m_record;
+
+  // The cycle in progress isn't kept across restarts, the charge that went
+  // by in between is unknown.
+  bool m_in_cycle = false;
+  int64_t m_cycle_uc = 0;
+
+  bool m_have_previous = false;
+  std::chrono::steady_clock::time_point m_previous;
+  int m_current_ma = 0; // battery side, positive while charging
+  unsigned m_battery_mv = 0;
+
+  std::chrono::steady_clock::time_point m_flushed;
+  bool m_dirty = false;
+
+  void integrate(std::chrono::milliseconds held);
+  void end_cycle();
+  void measure_resistance(const sample &s, int current_ma,
+                          std::chrono::steady_clock::duration since);
+
+public:
+  /// Totals are written out at least this often, and after every cycle.
+  static constexpr std::chrono::minutes flush_interval{10};
+
+  /**
+   * Carry on with the record in the file, or start a new one if there is
+   * none yet.
+   */
+  explicit tracker(const std::filesystem::path &path);
+  /// Writes out what's pending.
+  ~tracker();
+
+  tracker(const tracker &) = delete;
+  tracker &operator=(const tracker &) = delete;
+
+  /// Account for a sample. Constant time, logs every completed cycle.
+  void add(const sample &s);
+
+  /// Write the record out now. Doesn't throw, failures are logged.
+  void flush();
+
+  const record &get_record() const { return m_record; }
+};
+
+/**
+ * Read the record of a battery health file.
+ * @throw std::runtime_error if it can't be read or isn't one.
+ */
+record read(const std::filesystem::path &path);
+
+/**
+ * Print cycles, capacity, resistance and the charge throughput.
+ * @param rated_mah capacity of the pack when new, for the state of health.
+ */
+void print(text::writer &out, const record &r, unsigned rated_mah);
+
+} // namespace health
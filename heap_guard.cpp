@@ -0,0 +1,122 @@
+#include "heap_guard.h"
+#include "stats.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <unistd.h>
+
+#ifndef SW6106_HEAP_GUARD_STRICT
+#define SW6106_HEAP_GUARD_STRICT 0
+#endif
+
+namespace heap_guard {
+
+static std::atomic_bool armed{false};
+static std::atomic<uint64_t> allocations{0};
+static thread_local unsigned exempt = 0;
+
+void arm() { armed.store(true, std::memory_order_release); }
+
+exemption::exemption() { ++exempt; }
+exemption::~exemption() { --exempt; }
+
+uint64_t late_allocations() {
+  return allocations.load(std::memory_order_relaxed);
+}
+
+size_t resident_kb() {
+  // Read with stdio: it's startup, and iostreams would be overkill here.
+  FILE *statm = std::fopen("/proc/self/statm", "r");
+  if (statm == nullptr)
+    return 0;
+
+  unsigned long size = 0, resident = 0;
+  const int found = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+
+  if (found != 2)
+    return 0;
+
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void on_allocation() {
+  if (!armed.load(std::memory_order_relaxed) || exempt > 0)
+    return;
+
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  stats::heap_allocations.add();
+
+  if (SW6106_HEAP_GUARD_STRICT) {
+    static const char message[] =
+        "heap_guard: heap allocation after initialization\n";
+    ::write(STDERR_FILENO, message, sizeof(message) - 1);
+    std::abort();
+  }
+}
+
+static void *allocate(std::size_t size, std::size_t alignment = 0) {
+  on_allocation();
+
+  if (size == 0)
+    size = 1;
+
+  void *p = nullptr;
+  if (alignment > alignof(std::max_align_t)) {
+    if (posix_memalign(&p, alignment, size) != 0)
+      p = nullptr;
+  } else
+    p = std::malloc(size);
+
+  return p;
+}
+
+} // namespace heap_guard
+
+// Replacements of every global allocation function. All of them end up in
+// malloc/posix_memalign, so all deallocations are plain free().
+
+void *operator new(std::size_t size) {
+  if (void *p = heap_guard::allocate(size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return heap_guard::allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return heap_guard::allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  if (void *p = heap_guard::allocate(size, static_cast<size_t>(alignment)))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return operator new(size, alignment);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
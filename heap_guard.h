@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Keeps an eye on heap usage once the daemon is up. Every buffer the main loop
+// needs is sized on startup, so any allocation after arm() is a regression.
+// Global operator new is replaced to count them. With SW6106_HEAP_GUARD_STRICT
+// the first such allocation aborts the daemon, which is meant for soak tests.
+
+namespace heap_guard {
+
+/**
+ * Mark the end of initialization. Allocations from now on are counted.
+ */
+void arm();
+
+/**
+ * Number of allocations made after arm().
+ */
+uint64_t late_allocations();
+
+/**
+ * Allocations the calling thread makes while one of these is alive are not
+ * counted. For work that is meant to allocate, like reloading the config.
+ */
+class exemption {
+public:
+  exemption();
+  ~exemption();
+
+  exemption(const exemption &) = delete;
+  exemption &operator=(const exemption &) = delete;
+};
+
+/**
+ * Resident set size of the process, in kilobytes. Zero if unknown.
+ */
+size_t resident_kb();
+
+} // namespace heap_guard
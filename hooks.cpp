@@ -0,0 +1,134 @@
+#include "hooks.h"
+#include "process.h"
+#include "text.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+namespace fs = std::filesystem;
+
+// SW6106 hard cutoff, and where the linear tail of the discharge curve starts.
+static const unsigned cutoff_mv = 2950;
+static const unsigned tail_start_mv = 3400;
+// Share of the capacity left at tail_start_mv, in percent.
+static const unsigned tail_capacity_percent = 8;
+// Only trust half of the estimate: cells age, loads spike.
+static const unsigned safety_percent = 50;
+
+shutdown_hooks::shutdown_hooks(const fs::path &dir,
+                               std::chrono::milliseconds hook_timeout)
+    : m_hook_timeout(hook_timeout) {
+  if (dir.empty())
+    return;
+
+  if (!fs::is_directory(dir))
+    throw std::invalid_argument("Pre-shutdown hooks directory " +
+                                dir.generic_string() + " does not exist");
+
+  for (const auto &entry : fs::directory_iterator(dir)) {
+    const std::string name = entry.path().filename().string();
+    if (name.starts_with('.') || name.ends_with('~') ||
+        !entry.is_regular_file() ||
+        access(entry.path().c_str(), X_OK) != 0)
+      continue;
+
+    m_hooks.push_back(entry.path().generic_string());
+  }
+
+  std::sort(m_hooks.begin(), m_hooks.end());
+  m_running.resize(m_hooks.size());
+}
+
+bool shutdown_hooks::empty() const { return m_hooks.empty(); }
+
+const std::vector<std::string> &shutdown_hooks::list() const {
+  return m_hooks;
+}
+
+unsigned shutdown_hooks::run(std::chrono::milliseconds budget) {
+  if (m_hooks.empty())
+    return 0;
+
+  const auto start = steady_clock::now();
+  const auto deadline = start + std::min(budget, m_hook_timeout);
+
+  text::err() << "hooks: running " << m_hooks.size() << " pre-shutdown hooks, "
+            << duration_cast<milliseconds>(deadline - start).count()
+            << " ms budget" << text::endl;
+
+  size_t left = 0;
+
+  for (size_t i = 0; i < m_hooks.size(); ++i) {
+    m_running[i] = process::spawn(m_hooks[i]);
+    if (m_running[i] < 0) {
+      text::err() << "hooks: failed to start " << m_hooks[i] << ": "
+                << strerror(-m_running[i]) << text::endl;
+      m_running[i] = 0;
+      continue;
+    }
+    ++left;
+  }
+
+  unsigned succeeded = 0;
+
+  while (left > 0) {
+    const bool late = steady_clock::now() >= deadline;
+
+    for (size_t i = 0; i < m_running.size(); ++i) {
+      if (m_running[i] == 0)
+        continue;
+
+      if (late) {
+        kill(-m_running[i], SIGKILL);
+        waitpid(m_running[i], nullptr, 0);
+        text::err() << "hooks: " << m_hooks[i] << " ran out of time, killed"
+                  << text::endl;
+      } else {
+        int status;
+        if (waitpid(m_running[i], &status, WNOHANG) != m_running[i])
+          continue;
+
+        const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        succeeded += ok;
+        text::err() << "hooks: " << m_hooks[i]
+                  << (ok ? " finished" : " failed") << " after "
+                  << duration_cast<milliseconds>(steady_clock::now() - start)
+                         .count()
+                  << " ms" << text::endl;
+      }
+
+      m_running[i] = 0;
+      --left;
+    }
+
+    if (left > 0)
+      std::this_thread::sleep_for(milliseconds(1));
+  }
+
+  return succeeded;
+}
+
+std::chrono::milliseconds time_to_cutoff(unsigned battery_voltage_mv,
+                                         unsigned discharge_current_ma,
+                                         unsigned capacity_mah) {
+  if (battery_voltage_mv <= cutoff_mv || discharge_current_ma == 0)
+    return milliseconds(0);
+
+  const uint64_t tail_mv =
+      std::min(battery_voltage_mv, tail_start_mv) - cutoff_mv;
+
+  // Charge left in µAh, then time in ms at the current discharge rate.
+  const uint64_t charge_uah = uint64_t(capacity_mah) * 1000 *
+                              tail_capacity_percent / 100 * tail_mv /
+                              (tail_start_mv - cutoff_mv);
+
+  const uint64_t time_ms = charge_uah * 3600 / discharge_current_ma;
+
+  return milliseconds(time_ms * safety_percent / 100);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * Actions to take before the system is powered off on low battery: flushing
+ * databases, parking disks, notifying peers and so on.
+ *
+ * Every executable in the hooks directory is started at once and each one has
+ * to finish within its own timeout and within the total time budget, whichever
+ * ends first. Stragglers are killed, so the shutdown itself is never late.
+ */
+class shutdown_hooks {
+  std::vector<std::string> m_hooks;
+  std::vector<pid_t> m_running; // Sized upfront, run() must not allocate
+  std::chrono::milliseconds m_hook_timeout;
+
+public:
+  /**
+   * Collect the hooks in run-parts fashion: regular executable files, sorted
+   * by name, hidden files and editor backups skipped.
+   * @param dir hooks directory, an empty path means no hooks.
+   */
+  shutdown_hooks(const std::filesystem::path &dir,
+                 std::chrono::milliseconds hook_timeout);
+
+  bool empty() const;
+  const std::vector<std::string> &list() const;
+
+  /**
+   * Run all of the hooks in parallel and wait for them.
+   * @param budget total time the hooks may take.
+   * @return number of hooks that finished successfully in time.
+   */
+  unsigned run(std::chrono::milliseconds budget);
+};
+
+/**
+ * Estimate how long the system can keep running on battery, minus a safety
+ * margin, before the SW6106 cuts the power at 2.95 V.
+ *
+ * Below ~3.4 V a Li-ion cell is in the steep tail of its discharge curve, which
+ * holds only a small share of its capacity and is close to linear. The charge
+ * left is interpolated over that tail and divided by the measured discharge
+ * current.
+ * @param capacity_mah nominal battery capacity.
+ * @return time to cutoff, zero if it's already too late or unknown.
+ */
+std::chrono::milliseconds time_to_cutoff(unsigned battery_voltage_mv,
+                                         unsigned discharge_current_ma,
+                                         unsigned capacity_mah);
@@ -3,32 +3,142 @@
 #include <fcntl.h>
 #include <linux/i2c-dev.h>
 #include <linux/i2c.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <thread>
 #include <unistd.h>
 
 #include "i2c.h"
+#include "stats.h"
 
 namespace i2c {
 
-void controller::write_vect(const byte devaddr, const vect &data) {
+error_class classify(int err) {
+  switch (err) {
+  case EAGAIN:    // arbitration lost
+  case ENXIO:     // no acknowledge, from some drivers
+  case EREMOTEIO: // no acknowledge, from the others
+  case ETIMEDOUT: // clock stretched past the adapter timeout
+  case EIO:
+  case EBUSY:
+  case EINTR:
+    return error_class::TRANSIENT;
+
+  case ENODEV: // adapter unbound, or gone with its USB bridge
+  case EBADF:
+  case ESHUTDOWN:
+    return error_class::REOPEN;
+
+  default:
+    return error_class::FATAL;
+  }
+}
+
+error::error(bool read, int code, unsigned attempts) : m_code(code) {
+  snprintf(m_what, sizeof(m_what),
+           "i2c::controller %s failed with error: %s, %u attempts",
+           read ? "read" : "write", strerror(code), attempts);
+}
+
+int controller::attempt(i2c_msg *messages, const unsigned count) {
+  i2c_rdwr_ioctl_data exchange[1];
+  exchange[0].msgs = messages;
+  exchange[0].nmsgs = count;
+
+  int err = 0;
+  if (m_bus)
+    err = m_bus->transfer(messages, count);
+  else if (ioctl(m_file_descriptor, I2C_RDWR, &exchange) < 0)
+    err = errno;
+
+  if (m_recorder)
+    m_recorder->transaction(messages, count, err);
+
+  return err;
+}
+
+bool controller::apply_timeout() {
+  // The kernel retries lost arbitration on its own, unless told not to.
+  return ioctl(m_file_descriptor, I2C_TIMEOUT, m_timeout.count() / 10) >= 0 &&
+         ioctl(m_file_descriptor, I2C_RETRIES, 0UL) >= 0;
+}
+
+void controller::reopen() {
+  // Buses have nothing to reopen, the retry is all there is.
+  if (m_bus)
+    return;
+
+  stats::i2c_reopens.add();
+  if (m_file_descriptor >= 0)
+    ::close(m_file_descriptor);
+
+  // Failing that, the next attempt fails with EBADF and lands here again.
+  m_file_descriptor = ::open(m_file_path.c_str(), O_RDWR);
+  if (m_file_descriptor >= 0 && m_timeout.count() > 0)
+    apply_timeout();
+}
+
+void controller::transfer(i2c_msg *messages, const unsigned count) {
+  using namespace std::chrono;
+
+  const bool is_read = messages[count - 1].flags & I2C_M_RD;
+  stats::scoped_timer timer(is_read ? stats::i2c_read : stats::i2c_write);
+
+  const auto start = steady_clock::now();
+  microseconds backoff = m_policy.backoff;
+  unsigned attempts = 0;
+  int err;
+
+  while (true) {
+    err = attempt(messages, count);
+    ++attempts;
+
+    if (err == 0) {
+      if (attempts > 1)
+        stats::i2c_recovered.add();
+      return;
+    }
+
+    stats::i2c_errors.add();
+    const error_class kind = classify(err);
+    if (kind == error_class::FATAL || attempts >= m_policy.attempts)
+      break;
+
+    const microseconds wait =
+        backoff + microseconds(m_jitter() % (backoff.count() / 2 + 1));
+    backoff *= 2;
+
+    // Give up now rather than past the budget.
+    if (steady_clock::now() - start + wait + m_timeout > m_policy.budget)
+      break;
+
+    std::this_thread::sleep_for(wait);
+    stats::i2c_retries.add();
+
+    if (kind == error_class::REOPEN)
+      reopen();
+  }
+
+  stats::i2c_failures.add();
+  throw error(is_read, err, attempts);
+}
+
+void controller::write_raw(const byte devaddr, const byte *data,
+                           const size_t size) {
   i2c_msg messages[1];
-  i2c_rdwr_ioctl_data write[1];
 
   messages[0].addr = static_cast<uint8_t>(devaddr);
   messages[0].flags = 0;
-  messages[0].len = data.size();
-  messages[0].buf = const_cast<uint8_t *>(data.data());
+  messages[0].len = size;
+  messages[0].buf = const_cast<uint8_t *>(data);
 
-  write[0].msgs = messages;
-  write[0].nmsgs = 1;
+  transfer(messages, 1);
+}
 
-  if (ioctl(m_file_descriptor, I2C_RDWR, &write) < 0) {
-    std::stringstream error;
-    error << "i2c::controller write failed with error: " << strerror(errno);
-    throw std::runtime_error(error.str());
-  }
+void controller::write_vect(const byte devaddr, const vect &data) {
+  write_raw(devaddr, data.data(), data.size());
 }
 
 void controller::write(const byte devaddr, const vect &reg,
@@ -56,14 +166,14 @@ void controller::write(const byte devaddr, const byte reg,
 }
 
 void controller::write(const byte devaddr, const byte reg, const byte payload) {
-  vect output = {reg, payload};
+  // The most common write by far, keep it off the heap.
+  const byte output[] = {reg, payload};
 
-  write_vect(devaddr, output);
+  write_raw(devaddr, output, sizeof(output));
 }
 
 vect controller::read(const byte devaddr, const vect &reg, const uint bytes) {
   i2c_msg messages[2];
-  i2c_rdwr_ioctl_data exchange[1];
   vect result(bytes);
 
   messages[0].addr = static_cast<uint8_t>(devaddr);
@@ -76,22 +186,13 @@ vect controller::read(const byte devaddr, const vect &reg, const uint bytes) {
   messages[1].len = bytes;
   messages[1].buf = reinterpret_cast<uint8_t *>(result.data());
 
-  exchange[0].msgs = messages;
-  exchange[0].nmsgs = 2;
-
-  if (ioctl(m_file_descriptor, I2C_RDWR, &exchange) < 0) {
-    std::stringstream error;
-    error << "i2c::controller read failed with error: " << strerror(errno);
-    throw std::runtime_error(error.str());
-  }
+  transfer(messages, 2);
 
   return result;
 }
 
 vect controller::read(const byte devaddr, const byte reg, const uint bytes) {
-
   i2c_msg messages[2];
-  i2c_rdwr_ioctl_data exchange[1];
   vect result(bytes);
 
   messages[0].addr = static_cast<uint8_t>(devaddr);
@@ -104,21 +205,13 @@ vect controller::read(const byte devaddr, const byte reg, const uint bytes) {
   messages[1].len = bytes;
   messages[1].buf = reinterpret_cast<uint8_t *>(result.data());
 
-  exchange[0].msgs = messages;
-  exchange[0].nmsgs = 2;
-
-  if (ioctl(m_file_descriptor, I2C_RDWR, &exchange) < 0) {
-    std::stringstream error;
-    error << "i2c::controller read failed with error: " << strerror(errno);
-    throw std::runtime_error(error.str());
-  }
+  transfer(messages, 2);
 
   return result;
 }
 
 byte controller::read(const byte devaddr, const vect &reg) {
   i2c_msg messages[2];
-  i2c_rdwr_ioctl_data exchange[1];
   byte result;
 
   messages[0].addr = static_cast<uint8_t>(devaddr);
@@ -131,21 +224,13 @@ byte controller::read(const byte devaddr, const vect &reg) {
   messages[1].len = 1;
   messages[1].buf = reinterpret_cast<uint8_t *>(&result);
 
-  exchange[0].msgs = messages;
-  exchange[0].nmsgs = 2;
-
-  if (ioctl(m_file_descriptor, I2C_RDWR, &exchange) < 0) {
-    std::stringstream error;
-    error << "i2c::controller read failed with error: " << strerror(errno);
-    throw std::runtime_error(error.str());
-  }
+  transfer(messages, 2);
 
   return result;
 }
 
 byte controller::read(const byte devaddr, const byte reg) {
   i2c_msg messages[2];
-  i2c_rdwr_ioctl_data exchange[1];
   byte result;
 
   messages[0].addr = static_cast<uint8_t>(devaddr);
@@ -158,35 +243,73 @@ byte controller::read(const byte devaddr, const byte reg) {
   messages[1].len = 1;
   messages[1].buf = reinterpret_cast<uint8_t *>(&result);
 
-  exchange[0].msgs = messages;
-  exchange[0].nmsgs = 2;
-
-  if (ioctl(m_file_descriptor, I2C_RDWR, &exchange) < 0) {
-    std::stringstream error;
-    error << "i2c::controller read failed with error: " << strerror(errno);
-    throw std::runtime_error(error.str());
-  }
+  transfer(messages, 2);
 
   return result;
 }
 
-controller::controller(const fs::path &adapter) : m_file_path(adapter) {}
+controller::controller(const fs::path &adapter)
+    : m_file_path(adapter),
+      m_jitter(static_cast<uint_fast32_t>(stats::now_ns())) {}
 
 controller::~controller() { close(); }
 
+static const std::string simulator_prefix = "sim:";
+
 void controller::open() {
+  const std::string path = m_file_path.generic_string();
+  // The simulator is the daemon's, not the library's.
+  if (path.starts_with(simulator_prefix))
+    throw std::runtime_error("i2c::controller can't open " + path +
+                             " on its own, it takes a simulator bus");
+
   m_file_descriptor = ::open(m_file_path.c_str(), O_RDWR);
   if (m_file_descriptor < 0) {
-    std::stringstream error;
-    error << "i2c::controller failed to open " << m_file_path << ": "
-          << strerror(errno);
-    throw std::runtime_error(error.str());
+    throw std::runtime_error("i2c::controller failed to open " +
+                             m_file_path.generic_string() + ": " +
+                             strerror(errno));
+  }
+}
+
+void controller::open(std::unique_ptr<bus> bus) { m_bus = std::move(bus); }
+
+bool controller::is_open() { return m_file_descriptor > 0 || m_bus; }
+
+bool controller::is_simulated() const {
+  return m_bus || m_file_path.generic_string().starts_with(simulator_prefix);
+}
+
+const fs::path &controller::path() const { return m_file_path; }
+
+void controller::set_timeout(std::chrono::milliseconds timeout) {
+  if (m_bus)
+    return;
+
+  // I2C_TIMEOUT takes the value in units of 10 ms.
+  unsigned long ticks = (timeout.count() + 9) / 10;
+  if (ticks == 0)
+    ticks = 1;
+
+  m_timeout = std::chrono::milliseconds(ticks * 10);
+
+  if (!apply_timeout()) {
+    throw std::runtime_error("i2c::controller failed to set timeout on " +
+                             m_file_path.generic_string() + ": " +
+                             strerror(errno));
   }
 }
 
-bool controller::is_open() { return m_file_descriptor > 0; }
+void controller::set_retry_policy(const retry_policy &policy) {
+  m_policy = policy;
+}
+
+void controller::record(std::shared_ptr<recorder> recorder) {
+  m_recorder = std::move(recorder);
+}
 
 void controller::close() {
+  m_bus.reset();
+
   if (m_file_descriptor < 0)
     return;
 
@@ -1,11 +1,16 @@
 // By gh/BortEngineerDude
 #pragma once
 #include "byte_util.h"
+#include <chrono>
+#include <exception>
 #include <filesystem>
 #include <memory>
+#include <random>
 
 // A wrapper for a Linux I2C "adapter file".
 
+struct i2c_msg;
+
 namespace i2c {
 
 using namespace bytes;
@@ -13,12 +18,111 @@ namespace fs = std::filesystem;
 
 class peripheral;
 
+/**
+ * What a failed transaction calls for, by its errno value.
+ */
+enum class error_class {
+  /// Lost arbitration, no acknowledge, timed out or a glitch on the lines:
+  /// worth trying again.
+  TRANSIENT,
+  /// The adapter went away or the descriptor is no good, e.g. the driver
+  /// was rebound: reopen the adapter file, then try again.
+  REOPEN,
+  /// Anything else, like a request the adapter can't do. Retrying won't
+  /// help.
+  FATAL
+};
+
+error_class classify(int err);
+
+/**
+ * Thrown once a transaction is given up on. Doesn't allocate, so it can be
+ * thrown and caught in the main loop.
+ */
+class error : public std::exception {
+  int m_code;
+  char m_what[128];
+
+public:
+  error(bool read, int code, unsigned attempts);
+
+  /// The errno value of the last attempt.
+  int code() const { return m_code; }
+  /// True unless the error is classified fatal.
+  bool transient() const { return classify(m_code) != error_class::FATAL; }
+  const char *what() const noexcept override { return m_what; }
+};
+
+/**
+ * How hard to try before a transaction fails.
+ */
+struct retry_policy {
+  /// Attempts per transaction, the first one included.
+  unsigned attempts = 4;
+  /// Wait before the first retry, doubled for every further one. A random
+  /// part of up to half of it is added, so devices sharing a bus don't
+  /// retry in lockstep.
+  std::chrono::microseconds backoff{1000};
+  /**
+   * Worst case for a whole transaction, retries and waits included. A retry
+   * that could end past it isn't started, given that every attempt is
+   * bounded by the timeout, see controller::set_timeout().
+   */
+  std::chrono::milliseconds budget{100};
+
+  /// A single attempt, for probing.
+  static retry_policy none() { return {1, {}, {}}; }
+};
+
+/**
+ * Something other than a kernel adapter to send transactions to, such as the
+ * simulator.
+ */
+class bus {
+public:
+  virtual ~bus() = default;
+
+  /**
+   * Carry out a combined transaction, like the I2C_RDWR ioctl would.
+   * @return 0 or an errno value.
+   */
+  virtual int transfer(i2c_msg *messages, unsigned count) = 0;
+};
+
+/**
+ * Gets to see every attempt at a transaction, such as a trace being recorded.
+ */
+class recorder {
+public:
+  virtual ~recorder() = default;
+
+  /**
+   * @param error errno of a failed attempt, 0 if it went through.
+   */
+  virtual void transaction(const i2c_msg *messages, unsigned count,
+                           int error) = 0;
+};
+
 class controller {
   friend class i2c::peripheral;
 
   fs::path m_file_path;
   int m_file_descriptor = -1;
+  std::unique_ptr<bus> m_bus;
+  std::shared_ptr<recorder> m_recorder;
+
+  retry_policy m_policy;
+  std::chrono::milliseconds m_timeout{0}; // 0 if left to the driver
+  std::minstd_rand m_jitter;
+
+  int attempt(i2c_msg *messages, const unsigned count);
+  bool apply_timeout();
+  void reopen();
 
+  // Every transaction ends up here.
+  void transfer(i2c_msg *messages, const unsigned count);
+
+  void write_raw(const byte devaddr, const byte *data, const size_t size);
   void write_vect(const byte devaddr, const vect &data);
 
   void write(const byte devaddr, const vect &reg, const vect &payload);
@@ -33,12 +137,41 @@ class controller {
 
 public:
   using ptr = std::shared_ptr<i2c::controller>;
+
+  /**
+   * @param device adapter file, or "sim:" followed by an optional simulator
+   * script for a simulated sw6106. The latter is opened on a simulator bus,
+   * see sim::open().
+   */
   controller(const fs::path &device);
   ~controller();
 
+  /// True if the device is a simulator or a replayed trace rather than
+  /// real hardware.
+  bool is_simulated() const;
+
   void open();
+  /// Send transactions to a bus instead of the device, such as a trace
+  /// replay.
+  void open(std::unique_ptr<bus> bus);
   bool is_open();
   void close();
+
+  const fs::path &path() const;
+
+  /**
+   * Limit how long the kernel may spend on a single transaction, including
+   * clock stretching and arbitration retries. The adapter driver rounds the
+   * value up to its own granularity (usually 10 ms).
+   */
+  void set_timeout(std::chrono::milliseconds timeout);
+
+  /// Retry failed transactions as set out by the policy. Failures are
+  /// classified with classify().
+  void set_retry_policy(const retry_policy &policy);
+
+  /// Pass every transaction from now on to a recorder, such as a trace.
+  void record(std::shared_ptr<recorder> recorder);
 };
 
 class peripheral {
@@ -0,0 +1,152 @@
+#include "libsw6106.h"
+#include "discovery.h"
+#include "sw6106.h"
+
+#include <memory>
+#include <string>
+
+// The C API mirrors the C++ enums, make sure they never drift apart. Every
+// flag is listed, and the interrupts add up to all of them.
+#define SW6106_MIRRORED(c, type, flag)                                         \
+  static_assert(SW6106_##c##_##flag ==                                        \
+                static_cast<uint32_t>(sw6106::type::flag))
+
+SW6106_MIRRORED(STATUS, system_status, PORT_A_CONNECTED);
+SW6106_MIRRORED(STATUS, system_status, PORT_MICRO_CONNECTED);
+SW6106_MIRRORED(STATUS, system_status, PORT_C_CONNECTED);
+SW6106_MIRRORED(STATUS, system_status, CHARGER_CONNECTED);
+SW6106_MIRRORED(STATUS, system_status, BOOST_CONVERTER_ENABLED);
+SW6106_MIRRORED(IRQ, interrupts, SHORT_CIRCUIT);
+SW6106_MIRRORED(IRQ, interrupts, IC_OVER_TEMPERATURE);
+SW6106_MIRRORED(IRQ, interrupts, BATTERY_OVER_TEMPERATURE);
+SW6106_MIRRORED(IRQ, interrupts, BATTERY_VOLTAGE_TOO_LOW);
+SW6106_MIRRORED(IRQ, interrupts, CHARGE_TIMEOUT);
+SW6106_MIRRORED(IRQ, interrupts, MICRO_USB_OVERVOLTAGE);
+SW6106_MIRRORED(IRQ, interrupts, TYPE_C_OVERVOLTAGE);
+SW6106_MIRRORED(IRQ, interrupts, BATTERY_VOLTAGE_TOO_HIGH);
+SW6106_MIRRORED(IRQ, interrupts, PORT_A_CONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, PORT_A_DISCONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, PORT_MICRO_CONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, PORT_MICRO_DISCONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, PORT_C_CONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, PORT_C_DISCONNECTED);
+SW6106_MIRRORED(IRQ, interrupts, SHORT_CONTROL_KEY_PRESS);
+SW6106_MIRRORED(IRQ, interrupts, FAST_CHARGE_STATUS_CHANGED);
+SW6106_MIRRORED(IRQ, interrupts, CHARGE_PERCENT_CHANGED);
+SW6106_MIRRORED(IRQ, interrupts, BOOST_CONVERTER_ENABLED);
+SW6106_MIRRORED(IRQ, interrupts, BOOST_CONVERTER_DISABLED);
+SW6106_MIRRORED(IRQ, interrupts, CHARGER_ENABLED);
+SW6106_MIRRORED(IRQ, interrupts, CHARGER_DISABLED);
+SW6106_MIRRORED(IRQ, interrupts, CHARGE_BELLOW_5_PERCENT);
+SW6106_MIRRORED(IRQ, interrupts, FULLY_CHARGED);
+SW6106_MIRRORED(IRQ, interrupts, WLED_STATE_CHANGED);
+
+static_assert((SW6106_IRQ_SHORT_CIRCUIT |
+               SW6106_IRQ_IC_OVER_TEMPERATURE |
+               SW6106_IRQ_BATTERY_OVER_TEMPERATURE |
+               SW6106_IRQ_BATTERY_VOLTAGE_TOO_LOW |
+               SW6106_IRQ_CHARGE_TIMEOUT |
+               SW6106_IRQ_MICRO_USB_OVERVOLTAGE |
+               SW6106_IRQ_TYPE_C_OVERVOLTAGE |
+               SW6106_IRQ_BATTERY_VOLTAGE_TOO_HIGH |
+               SW6106_IRQ_PORT_A_CONNECTED |
+               SW6106_IRQ_PORT_A_DISCONNECTED |
+               SW6106_IRQ_PORT_MICRO_CONNECTED |
+               SW6106_IRQ_PORT_MICRO_DISCONNECTED |
+               SW6106_IRQ_PORT_C_CONNECTED |
+               SW6106_IRQ_PORT_C_DISCONNECTED |
+               SW6106_IRQ_SHORT_CONTROL_KEY_PRESS |
+               SW6106_IRQ_FAST_CHARGE_STATUS_CHANGED |
+               SW6106_IRQ_CHARGE_PERCENT_CHANGED |
+               SW6106_IRQ_BOOST_CONVERTER_ENABLED |
+               SW6106_IRQ_BOOST_CONVERTER_DISABLED |
+               SW6106_IRQ_CHARGER_ENABLED |
+               SW6106_IRQ_CHARGER_DISABLED |
+               SW6106_IRQ_CHARGE_BELLOW_5_PERCENT |
+               SW6106_IRQ_FULLY_CHARGED |
+               SW6106_IRQ_WLED_STATE_CHANGED) ==
+              static_cast<uint32_t>(sw6106::interrupts::ALL));
+
+#undef SW6106_MIRRORED
+
+struct sw6106_device {
+  i2c::controller::ptr controller;
+  sw6106 psu;
+
+  sw6106_device(i2c::controller::ptr c) : controller(c), psu(c) {}
+};
+
+static thread_local std::string last_error;
+
+// Exceptions must never cross the C boundary.
+template <typename F> static int guarded(F &&f) {
+  try {
+    f();
+    return 0;
+  } catch (std::exception &e) {
+    last_error = e.what();
+  } catch (...) {
+    last_error = "Unknown error";
+  }
+
+  return -1;
+}
+
+extern "C" {
+
+sw6106_device *sw6106_open(const char *adapter) {
+  sw6106_device *device = nullptr;
+
+  guarded([&] {
+    if (adapter == nullptr)
+      throw std::invalid_argument("Adapter path is NULL");
+
+    std::filesystem::path path = adapter;
+    if (path == "auto") {
+      const auto found = discovery::find_sw6106();
+      if (found.empty())
+        throw std::runtime_error("No sw6106 devices found on any i2c bus");
+
+      path = found.front().adapter;
+    }
+
+    auto controller = std::make_shared<i2c::controller>(path);
+    controller->open();
+
+    device = new sw6106_device(controller);
+  });
+
+  return device;
+}
+
+int sw6106_snapshot(sw6106_device *device, struct sw6106_snapshot *snapshot) {
+  return guarded([&] {
+    if (device == nullptr || snapshot == nullptr)
+      throw std::invalid_argument("Device or snapshot is NULL");
+
+    if (snapshot->size < sizeof(struct sw6106_snapshot))
+      throw std::invalid_argument("Snapshot size is too small");
+
+    const auto s = device->psu.get_snapshot();
+    snapshot->status = static_cast<uint32_t>(s.status);
+    snapshot->charge_percent = s.charge_percent;
+    snapshot->battery_voltage_mv = s.battery_voltage_mv;
+    snapshot->output_voltage_mv = s.output_voltage_mv;
+    snapshot->charge_current_ma = s.charge_current_ma;
+    snapshot->discharge_current_ma = s.discharge_current_ma;
+  });
+}
+
+int sw6106_read_interrupts(sw6106_device *device, uint32_t *interrupts) {
+  return guarded([&] {
+    if (device == nullptr || interrupts == nullptr)
+      throw std::invalid_argument("Device or interrupts is NULL");
+
+    *interrupts = static_cast<uint32_t>(device->psu.read_interrupts());
+  });
+}
+
+void sw6106_close(sw6106_device *device) { delete device; }
+
+const char *sw6106_last_error(void) { return last_error.c_str(); }
+}
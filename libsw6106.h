@@ -0,0 +1,101 @@
+/*
+ * libsw6106 - C interface to SW6106 power management ICs.
+ *
+ * The interface is meant to stay binary compatible: structures passed to the
+ * library start with their own size, so new fields can only ever be appended,
+ * and existing functions never change their signatures.
+ */
+#ifndef LIBSW6106_H
+#define LIBSW6106_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The library exports these functions and nothing else. */
+#if defined(__GNUC__)
+#define SW6106_API __attribute__((visibility("default")))
+#else
+#define SW6106_API
+#endif
+
+/* System status bits, see sw6106::system_status. */
+#define SW6106_STATUS_PORT_A_CONNECTED (1u << 0)
+#define SW6106_STATUS_PORT_MICRO_CONNECTED (1u << 1)
+#define SW6106_STATUS_PORT_C_CONNECTED (1u << 2)
+#define SW6106_STATUS_CHARGER_CONNECTED (1u << 4)
+#define SW6106_STATUS_BOOST_CONVERTER_ENABLED (1u << 5)
+
+/* Interrupt bits, see sw6106::interrupts. */
+#define SW6106_IRQ_SHORT_CIRCUIT (1u << 0)
+#define SW6106_IRQ_IC_OVER_TEMPERATURE (1u << 1)
+#define SW6106_IRQ_BATTERY_OVER_TEMPERATURE (1u << 3)
+#define SW6106_IRQ_BATTERY_VOLTAGE_TOO_LOW (1u << 4)
+#define SW6106_IRQ_CHARGE_TIMEOUT (1u << 5)
+#define SW6106_IRQ_MICRO_USB_OVERVOLTAGE (1u << 6)
+#define SW6106_IRQ_TYPE_C_OVERVOLTAGE (1u << 7)
+#define SW6106_IRQ_BATTERY_VOLTAGE_TOO_HIGH (1u << 8)
+#define SW6106_IRQ_PORT_A_CONNECTED (1u << 9)
+#define SW6106_IRQ_PORT_A_DISCONNECTED (1u << 10)
+#define SW6106_IRQ_PORT_MICRO_CONNECTED (1u << 11)
+#define SW6106_IRQ_PORT_MICRO_DISCONNECTED (1u << 12)
+#define SW6106_IRQ_PORT_C_CONNECTED (1u << 13)
+#define SW6106_IRQ_PORT_C_DISCONNECTED (1u << 14)
+#define SW6106_IRQ_SHORT_CONTROL_KEY_PRESS (1u << 15)
+#define SW6106_IRQ_FAST_CHARGE_STATUS_CHANGED (1u << 16)
+#define SW6106_IRQ_CHARGE_PERCENT_CHANGED (1u << 17)
+#define SW6106_IRQ_BOOST_CONVERTER_ENABLED (1u << 18)
+#define SW6106_IRQ_BOOST_CONVERTER_DISABLED (1u << 19)
+#define SW6106_IRQ_CHARGER_ENABLED (1u << 20)
+#define SW6106_IRQ_CHARGER_DISABLED (1u << 21)
+#define SW6106_IRQ_CHARGE_BELLOW_5_PERCENT (1u << 22)
+#define SW6106_IRQ_FULLY_CHARGED (1u << 24)
+#define SW6106_IRQ_WLED_STATE_CHANGED (1u << 25)
+
+typedef struct sw6106_device sw6106_device;
+
+struct sw6106_snapshot {
+  /* Must be set by the caller to sizeof(struct sw6106_snapshot). */
+  uint32_t size;
+  uint32_t status;
+  uint32_t charge_percent;
+  uint32_t battery_voltage_mv;
+  uint32_t output_voltage_mv;
+  uint32_t charge_current_ma;
+  uint32_t discharge_current_ma;
+};
+
+/*
+ * Open an i2c adapter (e.g. "/dev/i2c-1") and attach to the SW6106 on it.
+ * Passing "auto" searches all adapters. Returns NULL on failure, see
+ * sw6106_last_error().
+ */
+SW6106_API sw6106_device *sw6106_open(const char *adapter);
+
+/* Read status and all ADC channels. Returns 0 on success, -1 on failure. */
+SW6106_API int sw6106_snapshot(sw6106_device *device,
+                               struct sw6106_snapshot *snapshot);
+
+/*
+ * Read and clear pending interrupts into a SW6106_IRQ_* mask.
+ * Returns 0 on success, -1 on failure.
+ */
+SW6106_API int sw6106_read_interrupts(sw6106_device *device,
+                                      uint32_t *interrupts);
+
+/* Release the device. Accepts NULL. */
+SW6106_API void sw6106_close(sw6106_device *device);
+
+/*
+ * Description of the last failure in the calling thread. Valid until the
+ * next library call from the same thread.
+ */
+SW6106_API const char *sw6106_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBSW6106_H */
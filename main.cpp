@@ -1,175 +1,856 @@
+#include "benchmark.h"
+#include "capture.h"
 #include "config.h"
+#include "discovery.h"
+#include "energy.h"
+#include "filter.h"
+#include "health.h"
+#include "heap_guard.h"
+#include "hooks.h"
+#include "poweroff.h"
+#include "process.h"
+#include "realtime.h"
+#include "reload.h"
+#include "report.h"
+#include "rules.h"
+#include "simulator.h"
+#include "spsc_ring.h"
+#include "stats.h"
+#include "telemetry.h"
+#include "text.h"
+#include "trace.h"
 #include "sw6106.h"
 
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cstring>
 #include <ctime>
 #include <gpiod.hpp>
-#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <thread>
+#include <unistd.h>
 
-bool keep_running = false;
+std::atomic_bool keep_running = false;
+std::atomic_bool capture_requested = false;
+
+// Samples waiting to be reported. Sized generously: a report only falls
+// behind when stdout is blocked, and then dropping is preferable to stalling
+// the acquisition.
+using report_ring = spsc_ring<sample, 64>;
+
+// Set by the handler, reported by the loop: nothing in a signal handler may
+// touch the output buffers.
+std::atomic_int stop_signal = 0;
 
 void sigint_handler(int signal, siginfo_t *, void *) {
-  std::cout << "Caught signal " << signal;
+  stop_signal = signal;
+  keep_running = false;
+}
+
+int print_discovered_config() {
+  const auto start = std::chrono::steady_clock::now();
+  const auto found = discovery::find_sw6106();
+  const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  text::out() << "# Generated by sw6106mon --discover, scanned "
+            << discovery::list_adapters().size() << " i2c buses in "
+            << elapsed.count() << " ms\n";
+
+  if (found.empty()) {
+    text::out() << "# No sw6106 devices found" << text::endl;
+    return 1;
+  }
+
+  for (size_t i = 0; i < found.size(); ++i) {
+    text::out() << "# sw6106 chip version " << found[i].chip_version << " on "
+              << found[i].adapter.generic_string() << '\n'
+              << (i == 0 ? "" : "# ") << "i2c_dev = "
+              << found[i].adapter.generic_string() << '\n';
+  }
+
+  text::out() << "poll_interval = 30" << text::endl;
+  return 0;
+}
+
+/**
+ * Kernels before 5.7 stamp GPIO events with CLOCK_REALTIME, later ones with
+ * CLOCK_MONOTONIC. Bring either to CLOCK_MONOTONIC: whichever clock the
+ * timestamp is closer to is the one it was taken with.
+ */
+std::chrono::nanoseconds edge_to_monotonic(std::chrono::nanoseconds edge) {
+  const auto monotonic = std::chrono::steady_clock::now().time_since_epoch();
+  const auto realtime = std::chrono::system_clock::now().time_since_epoch();
+
+  if (std::chrono::abs(edge - monotonic) <= std::chrono::abs(edge - realtime))
+    return edge;
+
+  return edge - (realtime - monotonic);
+}
+
+/**
+ * Wait for an edge on the interrupt line, a config update or a signal.
+ * @param timeout_ms -1 to wait for as long as it takes.
+ * @return true if there are edges to read.
+ */
+bool wait_for_edge(const gpiod::line &line, int reload_fd, int timeout_ms) {
+  pollfd fds[] = {{line.event_get_fd(), POLLIN, 0}, {reload_fd, POLLIN, 0}};
+
+  // A signal ends the wait as well, keep_running tells what it was.
+  if (poll(fds, 2, timeout_ms) <= 0)
+    return false;
+
+  return fds[0].revents & POLLIN;
+}
 
-  if (signal == SIGINT || signal == SIGQUIT || signal == SIGTERM) {
-    std::cout << "; stopping...";
-    keep_running = false;
+sample acquire(sw6106 &psu, filter::snapshot_filter &filters,
+               sw6106::system_status status,
+               const sw6106::interrupt_event &interrupts, unsigned edges) {
+  sample s;
+  s.timestamp = std::chrono::steady_clock::now();
+  s.wall_time = std::time(nullptr);
+  s.data.status = status;
+  s.interrupts = interrupts;
+  s.edges = edges;
+
+  s.charging = (static_cast<uint32_t>(status) &
+                static_cast<uint32_t>(sw6106::system_status::CHARGER_CONNECTED));
+
+  s.discharging =
+      (static_cast<uint32_t>(status) &
+       static_cast<uint32_t>(sw6106::system_status::BOOST_CONVERTER_ENABLED));
+
+  s.data.charge_percent = psu.get_charge_percent();
+
+  // Only what the chip measures in this state, the rest reads as 0 anyway.
+  using channel = sw6106::adc_channels;
+  unsigned channels = 0;
+
+  if (s.charging || s.discharging)
+    channels |= static_cast<unsigned>(channel::BATTERY_VOLTAGE);
+
+  if (s.discharging)
+    channels |= static_cast<unsigned>(channel::OUTPUT_VOLTAGE) |
+                static_cast<unsigned>(channel::DISCHARGE_CURRENT);
+
+  if (s.charging)
+    channels |= static_cast<unsigned>(channel::CHARGE_CURRENT);
+
+  if (channels != 0) {
+    const auto adc = psu.read_adc(static_cast<channel>(channels));
+    s.data.battery_voltage_mv = adc.battery_voltage_mv;
+    s.data.output_voltage_mv = adc.output_voltage_mv;
+    s.data.charge_current_ma = adc.charge_current_ma;
+    s.data.discharge_current_ma = adc.discharge_current_ma;
   }
 
-  std::cout << std::endl;
+  s.filtered = filters.push(s.data, s.charging, s.discharging);
+
+  return s;
+}
+
+/**
+ * Run the rules against a sample and start the hooks of the ones that fired.
+ * @return true if the system should be powered off.
+ */
+bool apply_rules(rules::program &program, sample &s) {
+  const auto result = program.evaluate(s);
+
+  s.rules_fired = program.fired().size();
+  for (size_t i = 0; i < program.fired().size(); ++i) {
+    const uint32_t rule = program.fired()[i];
+
+    if (i < s.rules.size()) {
+      const std::string &source = program.get_source(rule);
+      auto &text = s.rules[i];
+
+      if (source.size() < text.size()) {
+        std::memcpy(text.data(), source.c_str(), source.size() + 1);
+      } else {
+        const size_t kept = text.size() - 4;
+        std::memcpy(text.data(), source.data(), kept);
+        std::memcpy(text.data() + kept, "...", 4);
+      }
+    }
+
+    if (program.get_action(rule) == rules::action::HOOK) {
+      const pid_t pid = process::spawn(program.get_hook(rule));
+      if (pid < 0)
+        text::err() << "Failed to start " << program.get_hook(rule) << ": "
+                    << strerror(-pid) << text::endl;
+    }
+  }
+
+  // Rule hooks are not waited for, collect whichever have finished.
+  while (waitpid(-1, nullptr, WNOHANG) > 0)
+    ;
+
+  return result.poweroff;
+}
+
+// CLOCK_MONOTONIC time main() was entered.
+uint64_t started_ns = 0;
+
+/**
+ * Date a replayed sample by the trace rather than by the clock, so time
+ * windows of the rules come out the same at any replay speed.
+ */
+void use_recorded_time(sample &s, const trace::replay &replay) {
+  s.timestamp = std::chrono::steady_clock::time_point(
+      std::chrono::nanoseconds(started_ns) + replay.recorded());
+  s.wall_time = replay.wall_time();
+}
+
+void print_time_to_first_sample(const sample &s) {
+  const uint64_t sampled_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          s.timestamp.time_since_epoch())
+          .count();
+
+  text::out() << "Time to first sample: " << (sampled_ns - started_ns) / 1000
+              << " us" << text::endl;
+}
+
+void report_loop(report_ring &ring, bool print_stats,
+                 reload::archive_slot &archive, energy::ledger *ledger,
+                 health::tracker *health) {
+  // Reporting is best effort, let the acquisition win any contention.
+  setpriority(PRIO_PROCESS, gettid(), 10);
+
+  // Signals should interrupt the acquisition waits, not this thread.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGQUIT);
+  sigaddset(&signals, SIGTERM);
+  sigaddset(&signals, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  sample s;
+  while (true) {
+    const bool closed = ring.closed();
+
+    while (ring.pop(s)) {
+      stats::scoped_timer timer(stats::phase_report);
+      const uint64_t now = stats::now_ns();
+
+      const uint64_t sampled_ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              s.timestamp.time_since_epoch())
+              .count();
+
+      // A replay may date samples ahead of the clock.
+      if (now >= sampled_ns)
+        stats::queue_latency.record(now - sampled_ns);
+
+      if (s.edges > 0 && s.poweroff == sample::poweroff_state::NONE)
+        stats::edge_to_report.record(now - s.interrupts.timestamp.count());
+
+      print_report(text::out(), s);
+
+      // The outcome of a poweroff comes as the same sample again, the
+      // request itself is the last reading and counts.
+      const bool recorded = s.poweroff == sample::poweroff_state::NONE ||
+                            s.poweroff == sample::poweroff_state::REQUESTED;
+
+      if (ledger && recorded)
+        ledger->add(s);
+
+      if (health && recorded)
+        health->add(s);
+
+      if (recorded) {
+        // Only contended while a reload swaps the archive.
+        std::lock_guard lock(archive.lock);
+        if (archive.writer)
+          archive.writer->append({s.wall_time * 1000, s.data});
+      }
+
+      if (print_stats) {
+        print_time_to_first_sample(s);
+        print_stats = false;
+      }
+    }
+
+    // This will make journald happy
+    text::out().flush();
+
+    if (closed)
+      break;
+
+    ring.wait();
+  }
+}
+
+void sigusr1_handler(int) { stats::dump(STDOUT_FILENO); }
+
+void sigusr2_handler(int) { capture_requested = true; }
+
+/**
+ * Capture straight from the acquisition thread: nothing else may touch the
+ * bus meanwhile, and the capture is what timing matters for at that moment.
+ */
+void run_capture(sw6106 &psu, burst_capture &capture) {
+  const auto summary = capture.run(psu);
+
+  try {
+    capture.write();
+  } catch (std::runtime_error &e) {
+    text::err() << e.what() << text::endl;
+  }
+
+  text::err() << summary << text::endl;
+}
+
+void print_jitter(const char *what, const realtime::jitter_result &r) {
+  text::out() << what << ": worst " << r.max_ns / 1000 << " us, average "
+            << r.avg_ns / 1000 << " us over " << r.samples << " wakeups"
+            << text::endl;
 }
 
 void register_signal_handlers() {
-  struct sigaction sa;
+  struct sigaction sa {};
   sa.sa_sigaction = sigint_handler;
+  sa.sa_flags = SA_SIGINFO;
   sigaction(SIGINT, &sa, NULL);
   sigaction(SIGQUIT, &sa, NULL);
   sigaction(SIGTERM, &sa, NULL);
+
+  struct sigaction usr1 {};
+  usr1.sa_handler = sigusr1_handler;
+  usr1.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &usr1, NULL);
+
+  struct sigaction usr2 {};
+  usr2.sa_handler = sigusr2_handler;
+  usr2.sa_flags = SA_RESTART;
+  sigaction(SIGUSR2, &usr2, NULL);
 }
 
 int main(int argc, const char **argv) {
+  started_ns = stats::now_ns();
   register_signal_handlers();
   config cfg(argc, argv);
 
+  if (cfg.get_discover())
+    return print_discovered_config();
+
+  if (!cfg.get_export_archive().empty()) {
+    const auto result =
+        telemetry::export_csv(cfg.get_export_archive(), text::out());
+    text::err() << result << text::endl;
+    return 0;
+  }
+
+  if (!cfg.get_energy_query().empty()) {
+    energy::print(text::out(), energy::read(cfg.get_energy_query()));
+    return 0;
+  }
+
+  if (!cfg.get_health_query().empty()) {
+    health::print(text::out(), health::read(cfg.get_health_query()),
+                  cfg.get_battery_capacity());
+    return 0;
+  }
+
+  if (cfg.get_archive_benchmark()) {
+    text::out() << telemetry::benchmark() << text::endl;
+    return 0;
+  }
+
+  if (cfg.get_rules_benchmark()) {
+    text::out() << rules::benchmark() << text::endl;
+    return 0;
+  }
+
+  if (cfg.get_bytes_benchmark()) {
+    benchmark::byte_order(text::out());
+    return 0;
+  }
+
+  if (cfg.get_async_benchmark()) {
+    benchmark::async_i2c(text::out());
+    return 0;
+  }
+
+  if (cfg.get_i2c_dev_auto() && cfg.get_replay_trace().empty()) {
+    const auto found = discovery::find_sw6106();
+    if (found.empty())
+      throw std::runtime_error("No sw6106 devices found on any i2c bus");
+
+    cfg.set_i2c_dev_path(found.front().adapter);
+    text::out() << "Found sw6106 on " << found.front().adapter.generic_string()
+              << text::endl;
+  }
+
+  // Threads started from here on inherit the CPU mask, and the timer slack.
+  if (cfg.get_cpu_affinity() >= 0)
+    realtime::set_cpu_affinity(cfg.get_cpu_affinity());
+
+  if (cfg.get_low_power())
+    realtime::set_timer_slack(cfg.get_timer_slack());
+
+  if (cfg.get_jitter_check()) {
+    realtime::set_thread_policy(cfg.get_realtime_policy(),
+                                cfg.get_realtime_priority());
+    if (cfg.get_lock_memory())
+      realtime::lock_memory();
+
+    print_jitter("Wakeup jitter",
+                 realtime::measure_jitter(10000, std::chrono::milliseconds(1)));
+    return 0;
+  }
+
   i2c::controller::ptr i2c_controller;
 
   i2c_controller = std::make_shared<i2c::controller>(cfg.get_i2c_dev_path());
-  i2c_controller->open();
 
-  keep_running = !cfg.get_single_run();
-  const bool gpio_enabled = cfg.get_gpio_enabled();
-  const std::string gpio_chip = cfg.get_gpio_chip();
-  const std::chrono::seconds poll_interval = cfg.get_poll_interval();
+  // A replay answers in place of the device and stands in for the GPIO
+  // inputs as well.
+  trace::replay *replay = nullptr;
+  if (!cfg.get_replay_trace().empty()) {
+    auto r = std::make_unique<trace::replay>(cfg.get_replay_trace(),
+                                             cfg.get_replay_speed());
+    replay = r.get();
+    i2c_controller->open(std::move(r));
+  } else if (i2c_controller->is_simulated())
+    i2c_controller->open(sim::open(cfg.get_i2c_dev_path().generic_string()));
+  else
+    i2c_controller->open();
+
+  if (cfg.get_i2c_timeout().count() > 0)
+    i2c_controller->set_timeout(cfg.get_i2c_timeout());
+  i2c_controller->set_retry_policy(cfg.get_i2c_retry_policy());
+
+  keep_running =
+      !cfg.get_single_run() && !cfg.get_capture() && !cfg.get_adc_benchmark();
+  // A soak doesn't wait for anything, cycles follow each other right away.
+  const unsigned soak_cycles = cfg.get_soak_cycles();
+  if (soak_cycles > 0 && !i2c_controller->is_simulated())
+    throw std::invalid_argument("A soak runs against the simulator only");
+
+  bool gpio_enabled = replay ? replay->gpio_enabled()
+                             : cfg.get_gpio_enabled() && soak_cycles == 0;
+  std::chrono::seconds poll_interval = cfg.get_poll_interval();
+
+  if (!replay && i2c_controller->is_simulated() && keep_running &&
+      gpio_enabled)
+    throw std::invalid_argument(
+        "The simulator has no interrupt line, use poll_interval instead");
 
   gpiod::chip gpio(cfg.get_gpio_chip());
   gpiod::line interrupt_line;
 
-  if (keep_running && gpio_enabled) {
-    interrupt_line = gpio.get_line(cfg.get_gpio_line());
+  auto request_interrupt_line = [&](const config &settings) {
+    interrupt_line = gpio.get_line(settings.get_gpio_line());
     gpiod::line_request config;
 
     config.consumer = "Line";
     config.request_type = gpiod::line_request::EVENT_FALLING_EDGE;
     config.flags = gpiod::line_request::FLAG_BIAS_PULL_UP;
     interrupt_line.request(config);
+  };
+
+  if (keep_running && gpio_enabled && !replay)
+    request_interrupt_line(cfg);
+
+  std::shared_ptr<trace::writer> tracer;
+  if (!cfg.get_i2c_trace().empty()) {
+    tracer = std::make_shared<trace::writer>(cfg.get_i2c_trace(),
+                                             keep_running && gpio_enabled);
+    i2c_controller->record(tracer);
   }
 
-  sw6106 psu(i2c_controller);
+  // GPIO inputs are recorded along with the transactions, so a replay takes
+  // the same path through the loop.
+  auto gpio_input = [&](auto read) -> uint32_t {
+    const uint32_t value = replay ? replay->gpio() : read();
+    if (tracer)
+      tracer->gpio(value);
+
+    return value;
+  };
 
-  using irq = sw6106::interrupts;
-  irq interrupts;
-  interrupts = irq::ALL;
+  sw6106 psu(i2c_controller);
 
-  psu.enable_interrupts(interrupts);
-  interrupts = psu.read_interrupts(); // clear any pending interrupts
+  psu.enable_interrupts(sw6106::interrupts::ALL);
+  // clear any pending interrupts
+  auto interrupts = psu.read_interrupts(std::chrono::nanoseconds(0));
   auto status = psu.get_system_status();
 
   uint events = 0;
-  uint charge_percent = 0;
-  uint battery_voltage = 0;
+  // Edges are read into a fixed buffer, any excess is picked up next cycle.
+  std::array<gpiod::line_event, 16> edges;
+
+  // Allocated upfront, a capture is most useful when things go wrong.
+  std::optional<burst_capture> capture;
+  if (cfg.get_capture_duration().count() > 0)
+    capture.emplace(cfg.get_capture_duration(), cfg.get_capture_output(),
+                    cfg.get_capture_format());
+
+  if (cfg.get_capture()) {
+    run_capture(psu, *capture);
+    return 0;
+  }
 
-  bool poweroff = false;
-  bool charging = false;
-  bool discharging = false;
+  if (cfg.get_adc_benchmark()) {
+    benchmark::adc_reads(text::out(), psu);
+    return 0;
+  }
 
-  std::cout << "sw6106 chip version " << psu.get_chip_version() << std::endl;
+  // Not before the capture, it may be going to stdout.
+  text::out() << "sw6106 chip version " << psu.get_chip_version() << text::endl;
 
-  do {
-    if (!keep_running || !gpio_enabled || events > 0 ||
-        interrupt_line.get_value() == 0) {
-      events = 0;
+  if (!keep_running) {
+    filter::snapshot_filter unfiltered;
+    sample s = acquire(psu, unfiltered, status, {}, 0);
+    if (replay)
+      use_recorded_time(s, *replay);
 
-      charging =
-          (static_cast<uint32_t>(status) &
-           static_cast<uint32_t>(sw6106::system_status::CHARGER_CONNECTED));
+    text::out() << s << text::endl;
 
-      discharging = (static_cast<uint32_t>(status) &
-                     static_cast<uint32_t>(
-                         sw6106::system_status::BOOST_CONVERTER_ENABLED));
+    if (cfg.get_print_stats()) {
+      print_time_to_first_sample(s);
+      stats::dump(STDOUT_FILENO);
+    }
 
-      charge_percent = psu.get_charge_percent();
+    return 0;
+  }
 
-      // I am well aware of std::chrono ability to print formatted time,
-      // it's just bugged in the some versions of gcc.
-      auto time = std::time(nullptr);
-      auto localtime = std::localtime(&time);
+  // Set up and validated now, there is no time for that once the battery is
+  // running out.
+  std::optional<poweroff> shutdown;
+  std::optional<shutdown_hooks> hooks;
+  rules::program alert_rules = cfg.get_rules();
+  if (alert_rules.has_action(rules::action::POWEROFF)) {
+    // A simulated battery running out mustn't take the host down with it.
+    const bool simulated = i2c_controller->is_simulated();
+    if (cfg.get_poweroff_command(simulated).empty())
+      throw std::invalid_argument("Poweroff rules against a simulator or a "
+                                  "replay run simulated_poweroff_command, set "
+                                  "it to something harmless");
+
+    shutdown.emplace(cfg.get_poweroff_command(simulated),
+                     cfg.get_poweroff_deadline(), !simulated);
+    hooks.emplace(cfg.get_pre_shutdown_hooks_dir(simulated),
+                  cfg.get_pre_shutdown_hook_timeout());
+
+    if (!hooks->empty())
+      text::out() << hooks->list().size() << " pre-shutdown hooks found"
+                << text::endl;
+  }
 
-      std::cout << "\n-----\n"
-                << std::put_time(localtime, "%T") << "\nStatus:\n"
-                << status << "\n\nCharge: " << charge_percent << '%';
+  filter::snapshot_filter filters(cfg.get_voltage_filter(),
+                                  cfg.get_current_filter());
+
+  report_ring ring;
+  uint dropped_reports = 0;
+  reload::archive_slot archive;
+  if (!cfg.get_telemetry_archive().empty())
+    archive.writer = std::make_unique<telemetry::archive_writer>(
+        cfg.get_telemetry_archive(), cfg.get_telemetry_block_records());
+
+  std::optional<energy::ledger> ledger;
+  if (!cfg.get_energy_ledger().empty())
+    ledger.emplace(cfg.get_energy_ledger(), cfg.get_energy_flush_interval());
+
+  std::optional<health::tracker> health;
+  if (!cfg.get_battery_health().empty())
+    health.emplace(cfg.get_battery_health());
+
+  // Before any thread is started, SIGHUP belongs to the reloader.
+  reload::reloader::block_signal();
+
+  std::thread reporter(report_loop, std::ref(ring), cfg.get_print_stats(),
+                       std::ref(archive), ledger ? &*ledger : nullptr,
+                       health ? &*health : nullptr);
+
+  // Statistics dumps are handled by the reporter, away from the acquisition.
+  sigset_t usr1;
+  sigemptyset(&usr1);
+  sigaddset(&usr1, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &usr1, nullptr);
+
+  // Only the acquisition runs with elevated priority, the reporter was
+  // started before and keeps the default policy.
+  realtime::set_thread_policy(cfg.get_realtime_policy(),
+                              cfg.get_realtime_priority());
+
+  // Everything is allocated by now.
+  if (cfg.get_lock_memory())
+    realtime::lock_memory();
+
+  if (cfg.get_realtime_policy() != realtime::policy::OTHER ||
+      cfg.get_lock_memory() || cfg.get_cpu_affinity() >= 0)
+    print_jitter("Wakeup jitter self-check",
+                 realtime::measure_jitter(200, std::chrono::milliseconds(1)));
+
+  // Time zone data is loaded on first use, get it out of the way now.
+  tzset();
+
+  // The config the loop runs with, replaced as a whole on reload.
+  std::unique_ptr<config> reloaded;
+  const config *settings = &cfg;
+  reload::reloader reloader(argc, argv, cfg, !i2c_controller->is_simulated(),
+                            archive);
+
+  heap_guard::arm();
+  text::out() << "Resident memory after startup: " << heap_guard::resident_kb()
+            << " kB" << text::endl;
+
+  unsigned cycles = 0;
+  bool failed = false;
+
+  // Events of dropped samples ride along with the next one that makes it
+  // through, the battery health tracker counts cycles by them.
+  uint32_t undelivered_events = 0;
+
+  auto publish = [&](sample s) {
+    const uint32_t events =
+        static_cast<uint32_t>(s.interrupts.flags) | undelivered_events;
+    s.interrupts.flags = static_cast<sw6106::interrupts>(events);
+
+    if (ring.push(s)) {
+      undelivered_events = 0;
+    } else {
+      undelivered_events = events;
+      ++dropped_reports;
+      stats::dropped_reports.add();
+    }
+  };
 
-      // Battery voltage will return an actual value only when something
-      // actively working with a battery.
-      if (charging || discharging) {
-        battery_voltage = psu.get_battery_voltage_mv();
+  // A soak goes through a capture and a reload halfway, and waits for the
+  // reload to be handed over.
+  bool soak_reloading = false;
 
-        std::cout << "\nBattery voltage: " << battery_voltage << " mV";
-      }
+  do {
+    if (soak_cycles > 0 && cycles == soak_cycles / 2) {
+      kill(getpid(), SIGUSR2);
+      kill(getpid(), SIGHUP);
+      soak_reloading = true;
+    }
 
-      if (discharging)
-        std::cout << "\nOutput voltage: " << psu.get_output_voltage_mv()
-                  << " mV\nDischarge current: "
-                  << psu.get_discharge_current_ma() << " mA";
+    if (auto u = reloader.take()) {
+      soak_reloading = false;
 
-      if (charging)
-        std::cout << "\nCharge current: " << psu.get_charge_current_ma()
-                  << " mA";
+      if (u->rules)
+        alert_rules = std::move(*u->rules);
 
-      if (!keep_running) {
-        std::cout << std::endl;
-        return 0;
+      if (u->filters)
+        filters = std::move(*u->filters);
+
+      if (u->shutdown_changed) {
+        shutdown.swap(u->shutdown);
+        hooks.swap(u->hooks);
       }
 
-      if (interrupts != sw6106::interrupts::NONE)
-        std::cout << "\nEvents:\n" << interrupts << std::endl;
+      if (u->capture_changed)
+        capture.swap(u->capture);
 
-      if (!charging && discharging && cfg.get_power_off_on_low_charge()) {
-        if (charge_percent < cfg.get_low_charge_percent()) {
-          std::cout << "\nCharge percent is bellow "
-                    << cfg.get_low_charge_percent();
-          poweroff = true;
-        }
+      // A replay takes the recorded path through the loop regardless.
+      if (u->gpio_changed && !replay) {
+        heap_guard::exemption exempt;
 
-        if (battery_voltage < cfg.get_low_charge_voltage()) {
-          std::cout << "\nBattery voltage is bellow "
-                    << cfg.get_low_charge_voltage() << " mV";
-          poweroff = true;
-        }
+        if (interrupt_line)
+          interrupt_line.release();
 
-        if (poweroff) {
-          std::cout << ", powering off..." << std::endl;
-          int res = system("poweroff");
-          if (res == 0) {
-            std::cout << "System accepted poweroff call, quitting..."
-                      << std::endl;
-            return 0;
-          }
+        gpio_enabled = u->settings->get_gpio_enabled();
+        if (gpio_enabled) {
+          if (u->settings->get_gpio_chip() != settings->get_gpio_chip())
+            gpio.open(u->settings->get_gpio_chip());
 
-          std::cout << "\'poweroff\' system call failed!" << std::endl;
+          request_interrupt_line(*u->settings);
         }
       }
+
+      poll_interval = u->settings->get_poll_interval();
+      i2c_controller->set_retry_policy(u->settings->get_i2c_retry_policy());
+      reloaded.swap(u->settings);
+      settings = reloaded.get();
+      // The previous config and subsystems go with the update.
     }
 
-    if (gpio_enabled) {
-      try {
-        if (interrupt_line.event_wait(std::chrono::seconds(5)))
-          events = interrupt_line.event_read_multiple().size();
-      } catch (std::system_error &) {
+    try {
+      if (capture_requested.exchange(false)) {
+        if (capture)
+          run_capture(psu, *capture);
+        else
+          text::err() << "capture_duration_ms is not set, ignoring capture "
+                         "request"
+                      << text::endl;
       }
-    } else
-      std::this_thread::sleep_for(poll_interval);
 
-    interrupts = psu.read_interrupts();
+      if (!gpio_enabled || events > 0 ||
+          gpio_input([&] { return interrupt_line.get_value(); }) == 0) {
+        stats::cycles.add();
+        stats::scoped_timer timer(stats::phase_acquire);
+
+        sample s = acquire(psu, filters, status, interrupts, events);
+        if (replay)
+          use_recorded_time(s, *replay);
+        events = 0;
+
+        // The decision is made right here, independent of how fast the
+        // reports are written out.
+        const bool poweroff_requested = apply_rules(alert_rules, s);
+
+        // Handed over along with the rules, a missing one is a bug.
+        if (poweroff_requested && !shutdown)
+          text::err() << "A poweroff rule matched, but there is no poweroff "
+                         "command set up"
+                      << text::endl;
+
+        if (poweroff_requested && shutdown) {
+          s.poweroff = sample::poweroff_state::REQUESTED;
+          publish(s);
+
+          // Whatever is left after the hooks belongs to the poweroff itself.
+          const auto budget =
+              time_to_cutoff(s.filtered.battery_voltage_mv,
+                             s.filtered.discharge_current_ma,
+                             settings->get_battery_capacity()) -
+              settings->get_poweroff_deadline();
+
+          if (hooks && budget.count() > 0)
+            hooks->run(budget);
+          else if (hooks && !hooks->empty())
+            text::err() << "hooks: no time left for pre-shutdown hooks"
+                      << text::endl;
+
+          const bool accepted =
+              shutdown->execute() == poweroff::result::ACCEPTED;
+          s.poweroff = accepted ? sample::poweroff_state::ACCEPTED
+                                : sample::poweroff_state::FAILED;
+          publish(s);
+
+          if (accepted)
+            break;
+        } else
+          publish(s);
+      }
 
-    // Let the status registers to catch up
-    std::this_thread::sleep_for(std::chrono::milliseconds(200));
-    status = psu.get_system_status();
+      {
+        stats::scoped_timer timer(stats::phase_wait);
+
+        if (gpio_enabled) {
+          events = gpio_input([&] {
+            try {
+              // On low power nothing but an edge, a reload or a signal may
+              // wake the daemon up.
+              if (wait_for_edge(interrupt_line, reloader.fd(),
+                                cfg.get_low_power() ? -1 : 5000)) {
+                // event_read_multiple() would allocate a vector each time.
+                do
+                  edges[events++] = interrupt_line.event_read();
+                while (events < edges.size() &&
+                       interrupt_line.event_wait(std::chrono::nanoseconds(0)));
+              }
+            } catch (std::system_error &) {
+            }
+            stats::wakeups.add();
+            return events;
+          });
+          stats::gpio_events.add(events);
+        } else if (soak_reloading) {
+          // Until the update is taken, a signal may cut the wait short.
+          if (realtime::wait_for(std::chrono::seconds(5),
+                                 std::chrono::seconds(0), reloader.fd())) {
+            text::err() << "Soak: no reload within 5 s, stopping"
+                        << text::endl;
+            failed = true;
+            break;
+          }
+        } else if (!replay && soak_cycles == 0) {
+          // A reload or a signal doesn't wait for the next poll either.
+          realtime::wait_for(poll_interval,
+                             cfg.get_low_power() ? std::chrono::seconds(1)
+                                                 : std::chrono::seconds(0),
+                             reloader.fd());
+        }
+      }
 
-    // This will make journald happy
-    std::cout << std::flush;
-  } while (keep_running);
+      // Replayed edges come without timestamps.
+      const uint edge_times = replay ? 0 : events;
 
-  return 0;
+      // Events are read oldest first, the first edge is the one that raised
+      // the interrupt line.
+      interrupts = psu.read_interrupts(
+          edge_times == 0 ? std::chrono::nanoseconds(0)
+                          : edge_to_monotonic(edges.front().timestamp));
+
+      for (uint i = 0; i < edge_times; ++i)
+        stats::edge_to_handled.record(
+            (interrupts.handled - edge_to_monotonic(edges[i].timestamp))
+                .count());
+
+      // A replay keeps its own pace.
+      if (!replay && soak_cycles == 0) {
+        stats::scoped_timer timer(stats::phase_settle);
+
+        // Let the status registers to catch up
+        realtime::sleep_for(std::chrono::milliseconds(200));
+      }
+      status = psu.get_system_status();
+    } catch (i2c::error &e) {
+      // Out of retries. The next cycle starts over, after a pause long
+      // enough for the bus to settle.
+      // A trace cut short by a power loss ends in the middle of a cycle.
+      if (replay && replay->finished())
+        break;
+
+      if (!e.transient()) {
+        // Not thrown on: the reporter has to be stopped first, and what is
+        // queued, the ledger and the archive written out on the way.
+        text::err() << e.what() << ", stopping" << text::endl;
+        failed = true;
+        break;
+      }
+
+      stats::failed_cycles.add();
+      text::err() << e.what() << ", monitoring continues" << text::endl;
+
+      if (!replay && soak_cycles == 0)
+        realtime::sleep_for(std::chrono::seconds(1));
+    }
+  } while (keep_running && !(replay && replay->finished()) &&
+           !(soak_cycles > 0 && ++cycles >= soak_cycles));
+
+  if (stop_signal != 0)
+    text::out() << "Caught signal " << stop_signal.load() << "; stopping..."
+                << text::endl;
+
+  ring.close();
+  reporter.join();
+
+  if (dropped_reports > 0)
+    text::out() << "Dropped " << dropped_reports
+              << " reports while output was blocked" << text::endl;
+
+  if (replay)
+    text::out() << "Replayed " << replay->entries() << " trace entries, "
+                << replay->recorded().count() / 1000 << " ms of recorded time"
+                << text::endl;
+
+  if (cfg.get_print_stats()) {
+    stats::dump(STDOUT_FILENO);
+    text::out() << "Worst wakeup jitter: "
+              << realtime::max_wakeup_jitter_ns() / 1000 << " us\n"
+              << "Heap allocations after startup: "
+              << heap_guard::late_allocations() << text::endl;
+  }
+
+  if (soak_cycles > 0) {
+    const uint64_t late = heap_guard::late_allocations();
+    text::out() << "Soak: " << cycles << " cycles, " << late
+                << " heap allocations after startup" << text::endl;
+    if (late > 0)
+      return 1;
+  }
+
+  return failed ? 1 : 0;
 }
@@ -0,0 +1,107 @@
+#include "poweroff.h"
+#include "process.h"
+#include "text.h"
+
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <sys/reboot.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+static long long elapsed_us(steady_clock::time_point start) {
+  return duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+poweroff::poweroff(const std::filesystem::path &command,
+                   std::chrono::milliseconds deadline, bool fallback)
+    : m_command(command.generic_string()), m_deadline(deadline),
+      m_fallback(fallback) {
+  if (!command.is_absolute())
+    throw std::invalid_argument("poweroff command must be an absolute path: " +
+                                m_command);
+
+  if (access(m_command.c_str(), X_OK) != 0)
+    throw std::invalid_argument("poweroff command " + m_command +
+                                " is not executable: " + strerror(errno));
+}
+
+bool poweroff::run_command(steady_clock::time_point start) {
+  const pid_t pid = process::spawn(m_command);
+  if (pid < 0) {
+    text::err() << "poweroff: failed to spawn " << m_command << ": "
+              << strerror(-pid) << " after " << elapsed_us(start) << " us"
+              << text::endl;
+    return false;
+  }
+
+  text::err() << "poweroff: spawned " << m_command << " in " << elapsed_us(start)
+            << " us" << text::endl;
+
+  const auto deadline = start + m_deadline;
+  int status = 0;
+
+  while (true) {
+    pid_t res = waitpid(pid, &status, WNOHANG);
+    if (res == pid)
+      break;
+
+    if (res < 0) {
+      text::err() << "poweroff: waitpid failed: " << strerror(errno) << text::endl;
+      return false;
+    }
+
+    if (steady_clock::now() >= deadline) {
+      text::err() << "poweroff: " << m_command << " missed the "
+                << m_deadline.count() << " ms deadline" << text::endl;
+      kill(-pid, SIGKILL);
+      waitpid(pid, nullptr, 0);
+      return false;
+    }
+
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+
+  if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    text::err() << "poweroff: " << m_command << " accepted the request after "
+              << elapsed_us(start) << " us" << text::endl;
+    return true;
+  }
+
+  text::err() << "poweroff: " << m_command << " failed with status " << status
+            << " after " << elapsed_us(start) << " us" << text::endl;
+  return false;
+}
+
+void poweroff::force(steady_clock::time_point start) {
+  text::err() << "poweroff: falling back to reboot(RB_POWER_OFF), syncing "
+               "filesystems"
+            << text::endl;
+  sync();
+  text::err() << "poweroff: synced after " << elapsed_us(start) << " us"
+            << text::endl;
+
+  reboot(RB_POWER_OFF);
+
+  // Only reachable if the kernel refused, most likely for lack of
+  // CAP_SYS_BOOT.
+  text::err() << "poweroff: reboot(RB_POWER_OFF) failed: " << strerror(errno)
+            << text::endl;
+}
+
+poweroff::result poweroff::execute() {
+  const auto start = steady_clock::now();
+
+  if (run_command(start))
+    return result::ACCEPTED;
+
+  if (m_fallback)
+    force(start);
+  else
+    text::err() << "poweroff: fallback disabled, not forcing" << text::endl;
+
+  return result::FAILED;
+}
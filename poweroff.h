@@ -0,0 +1,44 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+
+/**
+ * Emergency system shutdown.
+ *
+ * The poweroff command is executed directly, without a shell or PATH lookup,
+ * and has to finish within a deadline. If it fails or misses the deadline,
+ * filesystems are synced and the kernel is asked to power off right away.
+ * Every stage is timed and logged to stderr, which is unbuffered.
+ */
+class poweroff {
+  std::string m_command;
+  std::chrono::milliseconds m_deadline;
+  bool m_fallback;
+
+  // Returns true if the command exited successfully before the deadline.
+  bool run_command(std::chrono::steady_clock::time_point start);
+  void force(std::chrono::steady_clock::time_point start);
+
+public:
+  enum class result { ACCEPTED, FAILED };
+
+  /**
+   * @param command absolute path of the poweroff executable. Checked right
+   * away, so a misconfiguration shows up on startup and not when the
+   * battery is about to run out.
+   * @param deadline how long the command may take before the fallback.
+   * @param fallback whether to force the poweroff if the command fails. Off
+   * when testing against the simulator, the host is not the one to go down.
+   */
+  poweroff(const std::filesystem::path &command,
+           std::chrono::milliseconds deadline, bool fallback = true);
+
+  /**
+   * Shut the system down.
+   * @return ACCEPTED if the poweroff command accepted the request. If the
+   * fallback succeeds, this never returns.
+   */
+  result execute();
+};
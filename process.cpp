@@ -0,0 +1,62 @@
+#include "process.h"
+#include "realtime.h"
+
+#include <csignal>
+#include <sched.h>
+#include <spawn.h>
+
+extern char **environ;
+
+namespace process {
+
+pid_t spawn(const std::string &path) {
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+
+  // The child must not inherit signals blocked or handled by the daemon.
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  for (int sig : {SIGINT, SIGQUIT, SIGTERM, SIGUSR1, SIGUSR2, SIGHUP})
+    sigaddset(&defaults, sig);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+
+  // Nor the realtime policy of the acquisition thread, a busy hook would
+  // starve the system.
+  sched_param param{};
+  posix_spawnattr_setschedpolicy(&attr, SCHED_OTHER);
+  posix_spawnattr_setschedparam(&attr, &param);
+
+  // A group of its own, whatever it starts is killed along with it.
+  posix_spawnattr_setpgroup(&attr, 0);
+
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+                                      POSIX_SPAWN_SETSIGDEF |
+                                      POSIX_SPAWN_SETSCHEDULER |
+                                      POSIX_SPAWN_SETPGROUP);
+
+  // There's no attribute for the CPU mask, the child inherits the caller's.
+  // Unpinned just for the spawn.
+  const cpu_set_t *unpinned = realtime::unpinned_affinity();
+  cpu_set_t pinned;
+  if (unpinned && sched_getaffinity(0, sizeof(pinned), &pinned) == 0)
+    sched_setaffinity(0, sizeof(*unpinned), unpinned);
+  else
+    unpinned = nullptr;
+
+  char *argv[] = {const_cast<char *>(path.c_str()), nullptr};
+
+  pid_t pid;
+  int err = posix_spawn(&pid, path.c_str(), nullptr, &attr, argv, environ);
+  posix_spawnattr_destroy(&attr);
+
+  if (unpinned)
+    sched_setaffinity(0, sizeof(pinned), &pinned);
+
+  return err == 0 ? pid : -err;
+}
+
+} // namespace process
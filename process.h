@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <sys/types.h>
+
+// Helpers to run external programs from the shutdown path.
+
+namespace process {
+
+/**
+ * Start an executable directly with posix_spawn: no shell, no PATH lookup.
+ * The child starts with an empty signal mask and default handlers for every
+ * signal the daemon handles, on the default scheduling policy and on every
+ * CPU the daemon could use before it pinned itself. It leads a process group
+ * of its own, kill(-pid) reaches whatever it started as well.
+ * @return pid of the child, or -errno if it could not be started.
+ */
+pid_t spawn(const std::string &path);
+
+} // namespace process
@@ -0,0 +1,185 @@
+#include "realtime.h"
+#include "stats.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <time.h>
+
+namespace realtime {
+
+static std::atomic<uint64_t> jitter_max_ns{0};
+static std::atomic<uint64_t> jitter_sum_ns{0};
+static std::atomic<uint64_t> jitter_count{0};
+
+static void throw_errno(const std::string &what, int err) {
+  throw std::runtime_error(what + ": " + strerror(err));
+}
+
+void set_thread_policy(policy p, int priority) {
+  sched_param param{};
+  int native = SCHED_OTHER;
+
+  switch (p) {
+  case policy::FIFO:
+    native = SCHED_FIFO;
+    param.sched_priority = priority;
+    break;
+  case policy::RR:
+    native = SCHED_RR;
+    param.sched_priority = priority;
+    break;
+  case policy::OTHER:
+    break;
+  }
+
+  int err = pthread_setschedparam(pthread_self(), native, &param);
+  if (err != 0)
+    throw_errno("Failed to set scheduling policy", err);
+}
+
+// Set once before any thread is started, read-only after.
+static cpu_set_t unpinned_set;
+static bool pinned = false;
+
+void set_cpu_affinity(int cpu) {
+  if (sched_getaffinity(0, sizeof(unpinned_set), &unpinned_set) != 0)
+    throw_errno("Failed to get the CPU mask", errno);
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+
+  if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    throw_errno("Failed to pin to CPU " + std::to_string(cpu), errno);
+
+  pinned = true;
+}
+
+const cpu_set_t *unpinned_affinity() {
+  return pinned ? &unpinned_set : nullptr;
+}
+
+// Touch enough stack for the deepest call chain of the acquisition loop, so
+// that its pages are present before they get locked.
+static void prefault_stack() {
+  volatile char stack[256 * 1024];
+  for (size_t i = 0; i < sizeof(stack); i += 4096)
+    stack[i] = 0;
+}
+
+void set_timer_slack(std::chrono::nanoseconds slack) {
+  if (prctl(PR_SET_TIMERSLACK, static_cast<unsigned long>(slack.count()), 0,
+            0, 0) != 0)
+    throw_errno("Failed to set timer slack", errno);
+}
+
+void lock_memory() {
+  prefault_stack();
+
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    throw_errno("Failed to lock memory", errno);
+}
+
+static uint64_t to_ns(const timespec &ts) {
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static timespec to_timespec(uint64_t ns) {
+  return {static_cast<time_t>(ns / 1000000000ULL),
+          static_cast<long>(ns % 1000000000ULL)};
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC deadline, return lateness.
+static uint64_t sleep_until(uint64_t deadline_ns) {
+  const timespec deadline = to_timespec(deadline_ns);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) ==
+         EINTR)
+    ;
+
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  const uint64_t now_ns = to_ns(now);
+
+  return now_ns > deadline_ns ? now_ns - deadline_ns : 0;
+}
+
+static void record_wakeup(uint64_t late) {
+  stats::wakeups.add();
+  stats::wakeup_jitter.record(late);
+  jitter_sum_ns.fetch_add(late, std::memory_order_relaxed);
+  jitter_count.fetch_add(1, std::memory_order_relaxed);
+
+  uint64_t max = jitter_max_ns.load(std::memory_order_relaxed);
+  while (late > max && !jitter_max_ns.compare_exchange_weak(
+                           max, late, std::memory_order_relaxed))
+    ;
+}
+
+void sleep_for(std::chrono::nanoseconds duration) {
+  record_wakeup(sleep_until(stats::now_ns() + duration.count()));
+}
+
+bool wait_for(std::chrono::nanoseconds duration, std::chrono::nanoseconds grid,
+              int fd) {
+  uint64_t deadline = stats::now_ns() + duration.count();
+  if (grid.count() > 0) {
+    const uint64_t step = grid.count();
+    deadline = (deadline + step - 1) / step * step;
+  }
+
+  pollfd p{fd, POLLIN, 0};
+  while (true) {
+    const uint64_t now = stats::now_ns();
+    if (now >= deadline) {
+      record_wakeup(now - deadline);
+      return true;
+    }
+
+    const timespec timeout = to_timespec(deadline - now);
+    if (ppoll(&p, 1, &timeout, nullptr) != 0) {
+      stats::wakeups.add();
+      return false;
+    }
+  }
+}
+
+uint64_t max_wakeup_jitter_ns() {
+  return jitter_max_ns.load(std::memory_order_relaxed);
+}
+
+uint64_t avg_wakeup_jitter_ns() {
+  const uint64_t count = jitter_count.load(std::memory_order_relaxed);
+  return count ? jitter_sum_ns.load(std::memory_order_relaxed) / count : 0;
+}
+
+jitter_result measure_jitter(unsigned iterations,
+                             std::chrono::nanoseconds period) {
+  jitter_result result;
+  uint64_t sum = 0;
+  uint64_t deadline = stats::now_ns();
+
+  for (unsigned i = 0; i < iterations; ++i) {
+    deadline += period.count();
+    const uint64_t late = sleep_until(deadline);
+
+    sum += late;
+    if (late > result.max_ns)
+      result.max_ns = late;
+    ++result.samples;
+  }
+
+  if (result.samples)
+    result.avg_ns = sum / result.samples;
+
+  return result;
+}
+
+} // namespace realtime
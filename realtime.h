@@ -0,0 +1,82 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sched.h>
+
+// Scheduling and memory settings that keep the acquisition path responsive
+// on a loaded system.
+
+namespace realtime {
+
+enum class policy { OTHER, FIFO, RR };
+
+/**
+ * Switch the calling thread to a scheduling policy. Threads it starts later
+ * inherit the policy, threads already running keep their own.
+ * @param priority 1-99, ignored for OTHER.
+ */
+void set_thread_policy(policy p, int priority);
+
+/**
+ * Pin the whole process to one CPU. Call before starting threads so they
+ * inherit the mask.
+ */
+void set_cpu_affinity(int cpu);
+
+/**
+ * The CPU mask from before set_cpu_affinity(), for the programs the daemon
+ * starts. Null if it wasn't called.
+ */
+const cpu_set_t *unpinned_affinity();
+
+/**
+ * Prefault the stack and lock all current and future pages into RAM, so the
+ * acquisition path never waits for a page fault.
+ */
+void lock_memory();
+
+/**
+ * Let the kernel delay timer wakeups of the calling thread by up to slack,
+ * to serve them together with other timers instead of waking the CPU just
+ * for them. Threads it starts later inherit the slack. The kernel ignores it
+ * for realtime policies.
+ */
+void set_timer_slack(std::chrono::nanoseconds slack);
+
+/**
+ * Sleep on CLOCK_MONOTONIC and record how late the wakeup was.
+ */
+void sleep_for(std::chrono::nanoseconds duration);
+
+/**
+ * Like sleep_for, but a signal or fd becoming readable ends the wait early.
+ * With a grid, wake up on the next multiple of it on CLOCK_MONOTONIC at or
+ * after duration: periodic timers of the kernel and other services tend to
+ * fire on whole seconds, a wakeup aligned with them often comes for free.
+ * @param grid zero for no alignment.
+ * @return false if the wait was cut short.
+ */
+bool wait_for(std::chrono::nanoseconds duration, std::chrono::nanoseconds grid,
+              int fd);
+
+/**
+ * Worst and average wakeup lateness observed by sleep_for, in nanoseconds.
+ */
+uint64_t max_wakeup_jitter_ns();
+uint64_t avg_wakeup_jitter_ns();
+
+struct jitter_result {
+  uint64_t max_ns = 0;
+  uint64_t avg_ns = 0;
+  unsigned samples = 0;
+};
+
+/**
+ * Measure wakeup jitter of the calling thread: sleep to absolute deadlines
+ * spaced by period and see how late each wakeup is.
+ */
+jitter_result measure_jitter(unsigned iterations,
+                             std::chrono::nanoseconds period);
+
+} // namespace realtime
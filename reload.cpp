@@ -0,0 +1,278 @@
+#include "reload.h"
+#include "heap_guard.h"
+#include "text.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace reload {
+
+static bool same_rules(const rules::program &a, const rules::program &b) {
+  if (a.size() != b.size())
+    return false;
+
+  for (uint32_t i = 0; i < a.size(); ++i)
+    if (a.get_source(i) != b.get_source(i))
+      return false;
+
+  return true;
+}
+
+static bool same_filters(const config &a, const config &b) {
+  return a.get_voltage_filter() == b.get_voltage_filter() &&
+         a.get_current_filter() == b.get_current_filter();
+}
+
+static bool same_shutdown(const config &a, const config &b, bool simulated) {
+  return a.get_rules().has_action(rules::action::POWEROFF) ==
+             b.get_rules().has_action(rules::action::POWEROFF) &&
+         a.get_poweroff_command(simulated) ==
+             b.get_poweroff_command(simulated) &&
+         a.get_poweroff_deadline() == b.get_poweroff_deadline() &&
+         a.get_pre_shutdown_hooks_dir(simulated) ==
+             b.get_pre_shutdown_hooks_dir(simulated) &&
+         a.get_pre_shutdown_hook_timeout() == b.get_pre_shutdown_hook_timeout();
+}
+
+static bool same_capture(const config &a, const config &b) {
+  return a.get_capture_duration() == b.get_capture_duration() &&
+         a.get_capture_output() == b.get_capture_output() &&
+         a.get_capture_format() == b.get_capture_format();
+}
+
+static bool same_gpio(const config &a, const config &b) {
+  return a.get_gpio_enabled() == b.get_gpio_enabled() &&
+         (!a.get_gpio_enabled() || (a.get_gpio_chip() == b.get_gpio_chip() &&
+                                    a.get_gpio_line() == b.get_gpio_line()));
+}
+
+static bool same_archive(const config &a, const config &b) {
+  return a.get_telemetry_archive() == b.get_telemetry_archive() &&
+         a.get_telemetry_block_records() == b.get_telemetry_block_records();
+}
+
+// Settings only read on startup.
+static bool needs_restart(const config &a, const config &b) {
+  // The running config holds the discovered device rather than "auto".
+  const bool device = !b.get_i2c_dev_auto() &&
+                      a.get_i2c_dev_path() != b.get_i2c_dev_path();
+
+  return device || a.get_realtime_policy() != b.get_realtime_policy() ||
+         a.get_realtime_priority() != b.get_realtime_priority() ||
+         a.get_lock_memory() != b.get_lock_memory() ||
+         a.get_cpu_affinity() != b.get_cpu_affinity() ||
+         a.get_low_power() != b.get_low_power() ||
+         a.get_timer_slack() != b.get_timer_slack() ||
+         a.get_i2c_trace() != b.get_i2c_trace() ||
+         a.get_i2c_timeout() != b.get_i2c_timeout() ||
+         a.get_energy_ledger() != b.get_energy_ledger() ||
+         a.get_energy_flush_interval() != b.get_energy_flush_interval() ||
+         a.get_battery_health() != b.get_battery_health();
+}
+
+reloader::reloader(int argc, const char **argv, const config &current,
+                   bool poweroff_fallback, archive_slot &archive)
+    : m_argc(argc), m_argv(argv), m_poweroff_fallback(poweroff_fallback),
+      m_archive(archive), m_running(current), m_handed_over(current) {
+  m_event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (m_event < 0)
+    throw std::runtime_error(std::string("Failed to create an eventfd: ") +
+                             strerror(errno));
+
+  m_thread = std::thread(&reloader::run, this);
+  m_native = m_thread.native_handle();
+}
+
+reloader::~reloader() {
+  m_stop = true;
+  pthread_kill(m_native, SIGHUP);
+  m_thread.join();
+  ::close(m_event);
+}
+
+void reloader::block_signal() {
+  sigset_t hup;
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &hup, nullptr);
+}
+
+void reloader::run() {
+  // Other signals are for the acquisition loop, which may be waiting for
+  // nothing but them.
+  sigset_t all;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, nullptr);
+
+  sigset_t hup;
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+
+  while (true) {
+    int signal = 0;
+    if (sigwait(&hup, &signal) != 0 || m_stop)
+      break;
+
+    reload();
+  }
+}
+
+void reloader::reload() {
+  // Everything here allocates, and is meant to.
+  heap_guard::exemption exempt;
+  text::writer log(STDERR_FILENO);
+
+  auto failed = [&log](const std::exception &e) {
+    log << "Config reload failed, keeping the current one: " << e.what()
+        << text::endl;
+  };
+
+  std::unique_ptr<config> next;
+  try {
+    next = std::make_unique<config>(m_argc, m_argv);
+  } catch (std::exception &e) {
+    failed(e);
+    return;
+  }
+
+  auto u = std::make_unique<update>();
+  std::unique_ptr<telemetry::archive_writer> archive;
+  std::string changed;
+
+  auto note = [&changed](const char *what) {
+    changed += changed.empty() ? " " : ", ";
+    changed += what;
+  };
+
+  {
+    // Diffed and handed over in one go: an update the loop took meanwhile
+    // changes what it runs with, and what this one has to be diffed against.
+    // take() only tries the lock, the loop never waits for it.
+    std::unique_lock lock(m_lock);
+
+    // The last update was taken, the loop runs with its config now.
+    if (!m_pending)
+      m_running = m_handed_over;
+
+    try {
+      if (!same_rules(m_running.get_rules(), next->get_rules())) {
+        u->rules = next->get_rules();
+        note("rules");
+      }
+
+      if (!same_filters(m_running, *next)) {
+        u->filters.emplace(next->get_voltage_filter(),
+                           next->get_current_filter());
+        note("filters");
+      }
+
+      // Same as on startup, no fallback means a simulated battery.
+      const bool simulated = !m_poweroff_fallback;
+      if (!same_shutdown(m_running, *next, simulated)) {
+        u->shutdown_changed = true;
+        if (next->get_rules().has_action(rules::action::POWEROFF)) {
+          if (next->get_poweroff_command(simulated).empty())
+            throw std::invalid_argument("Poweroff rules against a simulator "
+                                        "or a replay need "
+                                        "simulated_poweroff_command");
+
+          u->shutdown.emplace(next->get_poweroff_command(simulated),
+                              next->get_poweroff_deadline(),
+                              m_poweroff_fallback);
+          u->hooks.emplace(next->get_pre_shutdown_hooks_dir(simulated),
+                           next->get_pre_shutdown_hook_timeout());
+        }
+        note("poweroff");
+      }
+
+      if (!same_capture(m_running, *next)) {
+        u->capture_changed = true;
+        if (next->get_capture_duration().count() > 0)
+          u->capture.emplace(next->get_capture_duration(),
+                             next->get_capture_output(),
+                             next->get_capture_format());
+        note("capture");
+      }
+
+      if (!same_gpio(m_running, *next)) {
+        u->gpio_changed = true;
+        note("GPIO");
+      }
+
+      if (m_running.get_poll_interval() != next->get_poll_interval())
+        note("poll interval");
+
+      // The archive is the reporter's, it's swapped right here.
+      if (!same_archive(m_handed_over, *next)) {
+        if (!next->get_telemetry_archive().empty())
+          archive = std::make_unique<telemetry::archive_writer>(
+              next->get_telemetry_archive(),
+              next->get_telemetry_block_records());
+        note("telemetry archive");
+      }
+    } catch (std::exception &e) {
+      lock.unlock();
+      failed(e);
+
+      // A take() may have missed the lock meanwhile.
+      if (m_ready)
+        notify();
+      return;
+    }
+
+    // The old archive is flushed and closed once this returns.
+    if (!same_archive(m_handed_over, *next)) {
+      std::lock_guard archive_lock(m_archive.lock);
+      m_archive.writer.swap(archive);
+    }
+
+    if (needs_restart(m_running, *next))
+      log << "Config reloaded, the i2c device, timeout and trace, energy "
+             "ledger, battery health, scheduling, power and memory settings "
+             "take a restart to change\n";
+
+    log << "Config reloaded, changed:"
+        << (changed.empty() ? " nothing" : changed) << text::endl;
+
+    m_handed_over = *next;
+    u->settings = std::move(next);
+    m_pending = std::move(u);
+    m_ready = true;
+  }
+
+  // Only once the lock is free, so the loop doesn't wake up to miss it.
+  notify();
+}
+
+void reloader::notify() {
+  const uint64_t one = 1;
+  if (::write(m_event, &one, sizeof(one)) < 0) {
+    // Only fails if the counter is about to overflow, it's readable then.
+  }
+}
+
+std::unique_ptr<update> reloader::take() {
+  // Cleared whether or not there's an update to take: the reloader notifies
+  // again whenever it lets go of the lock with one pending, so the loop can
+  // go back to sleep if the lock is busy now.
+  uint64_t count;
+  if (::read(m_event, &count, sizeof(count)) < 0) {
+    // Not readable, nothing to clear.
+  }
+
+  if (!m_ready.load(std::memory_order_acquire))
+    return nullptr;
+
+  std::unique_lock lock(m_lock, std::try_to_lock);
+  if (!lock.owns_lock())
+    return nullptr;
+
+  m_ready = false;
+  return std::move(m_pending);
+}
+
+} // namespace reload
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "capture.h"
+#include "config.h"
+#include "filter.h"
+#include "hooks.h"
+#include "poweroff.h"
+#include "rules.h"
+#include "telemetry.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pthread.h>
+#include <string>
+#include <thread>
+
+// Config reload on SIGHUP, without a restart: the device stays open, the
+// interrupt masks stay programmed and nothing goes unmonitored meanwhile.
+//
+// The file is parsed and everything that depends on it is built on a thread
+// of its own. The acquisition loop picks the result up at its next wakeup
+// and swaps it in at once, which costs it a few pointer moves. Only the
+// subsystems whose settings changed are rebuilt, the rest keep their state.
+// A config that fails to parse or validate is reported and ignored.
+
+namespace reload {
+
+/// The telemetry archive, shared by the reporter and the reloader.
+struct archive_slot {
+  std::mutex lock;
+  std::unique_ptr<telemetry::archive_writer> writer;
+};
+
+/// Everything the acquisition loop has to swap in, empty if unchanged.
+struct update {
+  std::unique_ptr<config> settings;
+
+  std::optional<rules::program> rules;
+  std::optional<filter::snapshot_filter> filters;
+
+  // Rebuilt together. Both empty after the change if no rule powers off.
+  bool shutdown_changed = false;
+  std::optional<poweroff> shutdown;
+  std::optional<shutdown_hooks> hooks;
+
+  bool capture_changed = false;
+  std::optional<burst_capture> capture;
+
+  /// GPIO chip, line, or poll versus GPIO changed.
+  bool gpio_changed = false;
+};
+
+class reloader {
+  int m_argc;
+  const char **m_argv;
+  bool m_poweroff_fallback;
+  archive_slot &m_archive;
+
+  // The config the acquisition loop runs with, and the one handed over
+  // last. They differ until the next reload notices the handover.
+  config m_running;
+  config m_handed_over;
+
+  std::mutex m_lock;
+  std::unique_ptr<update> m_pending;
+  std::atomic_bool m_ready = false;
+  int m_event = -1; // readable while an update is pending
+
+  std::atomic_bool m_stop = false;
+  pthread_t m_native;
+  std::thread m_thread;
+
+  void run();
+  void reload();
+  void notify();
+
+public:
+  /**
+   * Start waiting for SIGHUP. The signal has to be blocked in every thread
+   * beforehand, see block_signal().
+   * @param current config the daemon started with.
+   * @param poweroff_fallback passed on to rebuilt poweroff objects.
+   */
+  reloader(int argc, const char **argv, const config &current,
+           bool poweroff_fallback, archive_slot &archive);
+  ~reloader();
+
+  reloader(const reloader &) = delete;
+  reloader &operator=(const reloader &) = delete;
+
+  /// Block SIGHUP in the calling thread and the threads it starts later.
+  static void block_signal();
+
+  /**
+   * Take the pending update, if there is one. Doesn't block or allocate,
+   * meant for the acquisition loop.
+   */
+  std::unique_ptr<update> take();
+
+  /// Readable while an update is pending, to wake the acquisition loop.
+  int fd() const { return m_event; }
+};
+
+} // namespace reload
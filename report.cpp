@@ -0,0 +1,93 @@
+#include "report.h"
+
+#include <algorithm>
+
+static void print_measurement(text::writer &out, const char *name,
+                              unsigned raw, unsigned filtered,
+                              const char *unit) {
+  out << '\n' << name << ": " << raw << ' ' << unit;
+
+  if (filtered != raw)
+    out << " (filtered " << filtered << ' ' << unit << ')';
+}
+
+text::writer &operator<<(text::writer &out, const sample &s) {
+  // I am well aware of std::chrono ability to print formatted time,
+  // it's just bugged in the some versions of gcc.
+  tm localtime;
+  char time[16];
+  localtime_r(&s.wall_time, &localtime);
+  strftime(time, sizeof(time), "%T", &localtime);
+
+  out << "\n-----\n"
+      << time << "\nStatus:\n"
+      << s.data.status << "\n\nCharge: " << s.data.charge_percent << '%';
+
+  // Battery voltage will return an actual value only when something
+  // actively working with a battery.
+  if (s.charging || s.discharging)
+    print_measurement(out, "Battery voltage", s.data.battery_voltage_mv,
+                      s.filtered.battery_voltage_mv, "mV");
+
+  if (s.discharging) {
+    print_measurement(out, "Output voltage", s.data.output_voltage_mv,
+                      s.filtered.output_voltage_mv, "mV");
+    print_measurement(out, "Discharge current", s.data.discharge_current_ma,
+                      s.filtered.discharge_current_ma, "mA");
+  }
+
+  if (s.charging)
+    print_measurement(out, "Charge current", s.data.charge_current_ma,
+                      s.filtered.charge_current_ma, "mA");
+
+  return out;
+}
+
+void print_report(text::writer &out, const sample &s) {
+  using poweroff_state = sample::poweroff_state;
+
+  switch (s.poweroff) {
+  case poweroff_state::ACCEPTED:
+    out << "System accepted poweroff call, quitting..." << text::endl;
+    return;
+  case poweroff_state::FAILED:
+    out << "Poweroff failed!" << text::endl;
+    return;
+  default:
+    break;
+  }
+
+  out << s;
+  // Whether the last line still has to be ended.
+  bool open = true;
+
+  if (s.interrupts.flags != sw6106::interrupts::NONE) {
+    out << "\nEvents";
+
+    if (s.edges > 0)
+      out << " (" << s.edges << " edges, handled in "
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 s.interrupts.latency())
+                 .count()
+          << " us)";
+
+    out << ":\n" << s.interrupts.flags << text::endl;
+    open = false;
+  }
+
+  if (s.rules_fired > 0 || s.poweroff == poweroff_state::REQUESTED)
+    open = true;
+
+  for (unsigned i = 0; i < std::min<unsigned>(s.rules_fired, s.rules.size());
+       ++i)
+    out << "\nRule matched: " << s.rules[i].data();
+
+  if (s.rules_fired > s.rules.size())
+    out << "\n" << s.rules_fired - s.rules.size() << " more rules matched";
+
+  if (s.poweroff == poweroff_state::REQUESTED)
+    out << "\nPowering off...";
+
+  if (open)
+    out << text::endl;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "sw6106.h"
+#include "text.h"
+
+#include <array>
+#include <chrono>
+#include <ctime>
+
+/**
+ * Everything the acquisition side learned during one cycle. Filled in by the
+ * acquisition thread and handed over to the reporting thread, which must not
+ * touch the device.
+ */
+struct sample {
+  enum class poweroff_state : uint8_t {
+    NONE,
+    REQUESTED, // Low charge detected, poweroff is about to be called
+    ACCEPTED,
+    FAILED
+  };
+
+  std::chrono::steady_clock::time_point timestamp{};
+  std::time_t wall_time = 0;
+
+  sw6106::snapshot data;     // as read
+  sw6106::snapshot filtered; // what decisions are made on
+  sw6106::interrupt_event interrupts;
+  unsigned edges = 0; // GPIO edges that led to this sample
+
+  bool charging = false;
+  bool discharging = false;
+
+  // Rules that fired on this sample, as written in the config. Copied, a
+  // reload may replace the rules program while the sample is queued. Longer
+  // ones are cut short with "...".
+  static constexpr size_t rule_text_size = 96;
+  std::array<std::array<char, rule_text_size>, 4> rules{};
+  unsigned rules_fired = 0;
+  poweroff_state poweroff = poweroff_state::NONE;
+};
+
+/**
+ * Print time, status and the measurements valid for the current mode.
+ */
+text::writer &operator<<(text::writer &out, const sample &s);
+
+/**
+ * Print a full daemon report: measurements, events and the rules that
+ * fired.
+ */
+void print_report(text::writer &out, const sample &s);
@@ -0,0 +1,512 @@
+#include "rules.h"
+#include "stats.h"
+
+#include <charconv>
+#include <span>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace rules {
+
+static const char *const channel_names[] = {
+    "charge_percent",    "battery_voltage_mv",   "output_voltage_mv",
+    "charge_current_ma", "discharge_current_ma",
+};
+
+static constexpr unsigned sw6106::snapshot::*channels[] = {
+    &sw6106::snapshot::charge_percent,
+    &sw6106::snapshot::battery_voltage_mv,
+    &sw6106::snapshot::output_voltage_mv,
+    &sw6106::snapshot::charge_current_ma,
+    &sw6106::snapshot::discharge_current_ma,
+};
+
+// Longest window of a rule, a year.
+static constexpr int64_t max_duration_ms = 365LL * 24 * 3600000;
+
+#define NAMED(ENUM, X) {#X, static_cast<uint32_t>(sw6106::ENUM::X)}
+
+static const std::pair<std::string_view, uint32_t> status_names[] = {
+    NAMED(system_status, PORT_A_CONNECTED),
+    NAMED(system_status, PORT_MICRO_CONNECTED),
+    NAMED(system_status, PORT_C_CONNECTED),
+    NAMED(system_status, CHARGER_CONNECTED),
+    NAMED(system_status, BOOST_CONVERTER_ENABLED),
+};
+
+static const std::pair<std::string_view, uint32_t> event_names[] = {
+    NAMED(interrupts, SHORT_CIRCUIT),
+    NAMED(interrupts, IC_OVER_TEMPERATURE),
+    NAMED(interrupts, BATTERY_OVER_TEMPERATURE),
+    NAMED(interrupts, BATTERY_VOLTAGE_TOO_LOW),
+    NAMED(interrupts, CHARGE_TIMEOUT),
+    NAMED(interrupts, MICRO_USB_OVERVOLTAGE),
+    NAMED(interrupts, TYPE_C_OVERVOLTAGE),
+    NAMED(interrupts, BATTERY_VOLTAGE_TOO_HIGH),
+    NAMED(interrupts, PORT_A_CONNECTED),
+    NAMED(interrupts, PORT_A_DISCONNECTED),
+    NAMED(interrupts, PORT_MICRO_CONNECTED),
+    NAMED(interrupts, PORT_MICRO_DISCONNECTED),
+    NAMED(interrupts, PORT_C_CONNECTED),
+    NAMED(interrupts, PORT_C_DISCONNECTED),
+    NAMED(interrupts, SHORT_CONTROL_KEY_PRESS),
+    NAMED(interrupts, FAST_CHARGE_STATUS_CHANGED),
+    NAMED(interrupts, CHARGE_PERCENT_CHANGED),
+    NAMED(interrupts, BOOST_CONVERTER_ENABLED),
+    NAMED(interrupts, BOOST_CONVERTER_DISABLED),
+    NAMED(interrupts, CHARGER_ENABLED),
+    NAMED(interrupts, CHARGER_DISABLED),
+    NAMED(interrupts, CHARGE_BELLOW_5_PERCENT),
+    NAMED(interrupts, FULLY_CHARGED),
+    NAMED(interrupts, WLED_STATE_CHANGED),
+};
+
+#undef NAMED
+
+namespace {
+
+// Recursive descent over whitespace separated tokens, emitting the condition
+// in postfix order as it goes.
+class parser {
+  std::string_view m_rest;
+  std::string_view m_token;
+  std::vector<program::instruction> &m_code;
+  size_t m_depth = 0;
+  size_t m_max_depth = 0;
+  size_t m_length = 0;
+
+  void advance() {
+    const size_t start = m_rest.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+      m_rest = m_token = {};
+      return;
+    }
+
+    m_rest.remove_prefix(start);
+    const size_t end = std::min(m_rest.find_first_of(" \t\r"), m_rest.size());
+    m_token = m_rest.substr(0, end);
+    m_rest.remove_prefix(end);
+  }
+
+  void emit(program::opcode op, uint8_t channel = 0, uint32_t value = 0) {
+    if (++m_length > program::max_instructions)
+      fail("Condition is too long");
+
+    // Operators pop two operands and push one, NOT replaces its operand.
+    if (op == program::opcode::AND || op == program::opcode::OR)
+      --m_depth;
+    else if (op != program::opcode::NOT)
+      m_max_depth = std::max(m_max_depth, ++m_depth);
+
+    if (m_max_depth > program::max_stack)
+      fail("Condition is nested too deep");
+
+    m_code.push_back({op, channel, value});
+  }
+
+  uint32_t flag(std::span<const std::pair<std::string_view, uint32_t>> names,
+                const char *what) {
+    for (const auto &[name, value] : names)
+      if (name == m_token) {
+        advance();
+        return value;
+      }
+
+    fail(std::string("Unknown ") + what);
+  }
+
+  void atom() {
+    if (m_token == "not") {
+      advance();
+      atom();
+      emit(program::opcode::NOT);
+      return;
+    }
+
+    if (m_token == "charging" || m_token == "discharging") {
+      emit(m_token == "charging" ? program::opcode::CHARGING
+                                 : program::opcode::DISCHARGING);
+      advance();
+      return;
+    }
+
+    if (m_token == "status") {
+      advance();
+      emit(program::opcode::STATUS, 0, flag(status_names, "status"));
+      return;
+    }
+
+    if (m_token == "event") {
+      advance();
+      emit(program::opcode::EVENT, 0, flag(event_names, "event"));
+      return;
+    }
+
+    uint8_t channel = 0;
+    while (channel < std::size(channel_names) &&
+           m_token != channel_names[channel])
+      ++channel;
+
+    if (channel == std::size(channel_names))
+      fail("Expected a condition");
+
+    advance();
+
+    program::opcode op;
+    if (m_token == "<")
+      op = program::opcode::LT;
+    else if (m_token == "<=")
+      op = program::opcode::LE;
+    else if (m_token == ">")
+      op = program::opcode::GT;
+    else if (m_token == ">=")
+      op = program::opcode::GE;
+    else if (m_token == "==")
+      op = program::opcode::EQ;
+    else if (m_token == "!=")
+      op = program::opcode::NE;
+    else
+      fail("Expected a comparison");
+
+    advance();
+    emit(op, channel, number());
+  }
+
+  void conjunction() {
+    atom();
+    while (m_token == "and") {
+      advance();
+      atom();
+      emit(program::opcode::AND);
+    }
+  }
+
+public:
+  parser(std::string_view source, std::vector<program::instruction> &code)
+      : m_rest(source), m_code(code) {
+    advance();
+  }
+
+  [[noreturn]] void fail(const std::string &what) const {
+    throw std::invalid_argument(
+        what + (m_token.empty() ? std::string(" at the end")
+                                : " at \"" + std::string(m_token) + '"'));
+  }
+
+  std::string_view token() const { return m_token; }
+
+  std::string_view take() {
+    const std::string_view token = m_token;
+    advance();
+    return token;
+  }
+
+  void expect(std::string_view token) {
+    if (m_token != token)
+      fail("Expected \"" + std::string(token) + '"');
+    advance();
+  }
+
+  uint32_t number() {
+    uint32_t value;
+    const auto [end, ec] =
+        std::from_chars(m_token.data(), m_token.data() + m_token.size(), value);
+    if (ec != std::errc() || end != m_token.data() + m_token.size())
+      fail("Expected a number");
+
+    advance();
+    return value;
+  }
+
+  int64_t duration_ms() {
+    int64_t value = 0;
+    const auto [end, ec] =
+        std::from_chars(m_token.data(), m_token.data() + m_token.size(), value);
+    const std::string_view unit(end, m_token.data() + m_token.size() - end);
+
+    int64_t scale = 0;
+    if (unit == "ms")
+      scale = 1;
+    else if (unit == "s")
+      scale = 1000;
+    else if (unit == "min")
+      scale = 60000;
+    else if (unit == "h")
+      scale = 3600000;
+
+    if (ec != std::errc() || value <= 0 || scale == 0)
+      fail("Expected a duration like 500ms, 30s, 5min or 1h");
+
+    // Also keeps the product in range.
+    if (value > max_duration_ms / scale)
+      fail("Durations should be at most a year");
+
+    advance();
+    return value * scale;
+  }
+
+  void condition() {
+    conjunction();
+    while (m_token == "or") {
+      advance();
+      conjunction();
+      emit(program::opcode::OR);
+    }
+  }
+};
+
+} // namespace
+
+void program::add(std::string_view source) {
+  rule r;
+  r.first = m_code.size();
+  r.source = source;
+
+  try {
+    parser parse(source, m_code);
+    parse.condition();
+
+    r.kind = window::NONE;
+    if (parse.token() == "for") {
+      parse.expect("for");
+      r.kind = window::FOR;
+      r.window_ms = parse.duration_ms();
+    } else if (parse.token() != "->") {
+      const uint32_t times = parse.number();
+      if (times < 1 || times > max_times)
+        throw std::invalid_argument("Times should be between 1 and " +
+                                    std::to_string(max_times));
+
+      parse.expect("times");
+      parse.expect("in");
+      r.kind = window::TIMES;
+      r.times = times;
+      r.window_ms = parse.duration_ms();
+    }
+
+    parse.expect("->");
+
+    const std::string_view action_name = parse.token();
+    if (action_name == "log")
+      r.action = action::LOG;
+    else if (action_name == "poweroff")
+      r.action = action::POWEROFF;
+    else if (action_name == "hook") {
+      parse.take();
+      r.action = action::HOOK;
+      r.hook = parse.token();
+
+      if (r.hook.empty() || r.hook.front() != '/' ||
+          access(r.hook.c_str(), X_OK) != 0)
+        parse.fail("Expected an absolute path to an executable");
+    } else
+      parse.fail("Expected log, poweroff or hook");
+
+    parse.take();
+    if (!parse.token().empty())
+      parse.fail("Unexpected text after the action");
+  } catch (...) {
+    m_code.resize(r.first);
+    throw;
+  }
+
+  r.length = m_code.size() - r.first;
+  r.hits = m_hits.size();
+  m_hits.resize(m_hits.size() + (r.kind == window::TIMES ? r.times : 0));
+
+  m_rules.push_back(std::move(r));
+  m_fired.reserve(m_rules.size());
+}
+
+program::program(const program &other)
+    : m_code(other.m_code), m_rules(other.m_rules), m_hits(other.m_hits),
+      m_fired(other.m_fired) {
+  // A vector copy is only as big as its contents, evaluate() mustn't grow it.
+  m_fired.reserve(m_rules.size());
+}
+
+program &program::operator=(const program &other) {
+  m_code = other.m_code;
+  m_rules = other.m_rules;
+  m_hits = other.m_hits;
+  m_fired = other.m_fired;
+  m_fired.reserve(m_rules.size());
+  return *this;
+}
+
+bool program::has_action(action a) const {
+  for (const rule &r : m_rules)
+    if (r.action == a)
+      return true;
+
+  return false;
+}
+
+bool program::condition(const rule &r, const sample &s) const {
+  bool stack[max_stack];
+  size_t top = 0;
+
+  const auto status = static_cast<uint32_t>(s.data.status);
+  const auto events = static_cast<uint32_t>(s.interrupts.flags);
+
+  for (uint32_t i = r.first; i < r.first + r.length; ++i) {
+    const instruction &in = m_code[i];
+
+    switch (in.op) {
+    case opcode::LT:
+      stack[top++] = s.filtered.*channels[in.channel] < in.value;
+      break;
+    case opcode::LE:
+      stack[top++] = s.filtered.*channels[in.channel] <= in.value;
+      break;
+    case opcode::GT:
+      stack[top++] = s.filtered.*channels[in.channel] > in.value;
+      break;
+    case opcode::GE:
+      stack[top++] = s.filtered.*channels[in.channel] >= in.value;
+      break;
+    case opcode::EQ:
+      stack[top++] = s.filtered.*channels[in.channel] == in.value;
+      break;
+    case opcode::NE:
+      stack[top++] = s.filtered.*channels[in.channel] != in.value;
+      break;
+    case opcode::STATUS:
+      stack[top++] = status & in.value;
+      break;
+    case opcode::EVENT:
+      stack[top++] = events & in.value;
+      break;
+    case opcode::CHARGING:
+      stack[top++] = s.charging;
+      break;
+    case opcode::DISCHARGING:
+      stack[top++] = s.discharging;
+      break;
+    case opcode::NOT:
+      stack[top - 1] = !stack[top - 1];
+      break;
+    case opcode::AND:
+      --top;
+      stack[top - 1] = stack[top - 1] && stack[top];
+      break;
+    case opcode::OR:
+      --top;
+      stack[top - 1] = stack[top - 1] || stack[top];
+      break;
+    }
+  }
+
+  return stack[0];
+}
+
+program::result program::evaluate(const sample &s) {
+  const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          s.timestamp.time_since_epoch())
+                          .count();
+  result res;
+  m_fired.clear();
+
+  for (uint32_t index = 0; index < m_rules.size(); ++index) {
+    rule &r = m_rules[index];
+    const bool holds = condition(r, s);
+    bool active = false;
+
+    switch (r.kind) {
+    case window::NONE:
+      active = holds;
+      break;
+
+    case window::FOR:
+      if (holds && !r.held)
+        r.since_ms = now;
+      active = holds && now - r.since_ms >= r.window_ms;
+      break;
+
+    case window::TIMES:
+      if (!holds)
+        break;
+
+      m_hits[r.hits + r.hit_next] = now;
+      r.hit_next = (r.hit_next + 1) % r.times;
+      r.hit_count = std::min<uint8_t>(r.hit_count + 1, r.times);
+
+      // The oldest of the last n hits is where the next one will go.
+      if (r.hit_count == r.times &&
+          now - m_hits[r.hits + r.hit_next] <= r.window_ms) {
+        active = true;
+        r.hit_count = 0;
+      }
+      break;
+    }
+
+    r.held = holds;
+
+    // Every rule fires once when it becomes active, a poweroff rule stays in
+    // effect for as long as it is.
+    if (active && !r.active)
+      m_fired.push_back(index);
+
+    if (active && r.action == action::POWEROFF)
+      res.poweroff = true;
+
+    r.active = active;
+  }
+
+  return res;
+}
+
+benchmark_result benchmark(size_t rules, size_t samples) {
+  static const char *const templates[] = {
+      "discharge_current_ma > 2000 for 30s -> log",
+      "event IC_OVER_TEMPERATURE 2 times in 5min -> log",
+      "not status PORT_C_CONNECTED and charge_percent < 20 -> log",
+      "discharging and not charging and battery_voltage_mv < 3000 -> log",
+      "output_voltage_mv < 4750 or output_voltage_mv > 5250 for 2s -> log",
+  };
+
+  program p;
+  for (size_t i = 0; i < rules; ++i)
+    p.add(templates[i % std::size(templates)]);
+
+  uint32_t seed = 1;
+  auto noise = [&seed](unsigned range) {
+    seed = seed * 1664525 + 1013904223;
+    return (seed >> 16) % range;
+  };
+
+  sample s;
+  s.discharging = true;
+  s.data.status = sw6106::system_status::BOOST_CONVERTER_ENABLED;
+
+  benchmark_result result;
+  result.rules = rules;
+  result.samples = samples;
+
+  for (size_t i = 0; i < samples; ++i) {
+    s.timestamp += std::chrono::seconds(1);
+    s.filtered.charge_percent = 100 - i * 100 / samples;
+    s.filtered.battery_voltage_mv = 4200 - i * 1200 / samples;
+    s.filtered.output_voltage_mv = 4700 + noise(600);
+    s.filtered.discharge_current_ma = noise(2500);
+    s.interrupts.flags = noise(100) == 0
+                             ? sw6106::interrupts::IC_OVER_TEMPERATURE
+                             : sw6106::interrupts::NONE;
+
+    const uint64_t start = stats::now_ns();
+    p.evaluate(s);
+    result.ns += stats::now_ns() - start;
+  }
+
+  return result;
+}
+
+text::writer &operator<<(text::writer &out, const benchmark_result &r) {
+  const uint64_t per_sample = r.samples ? r.ns / r.samples : 0;
+
+  return out << r.rules << " rules over " << r.samples << " samples: "
+             << per_sample << " ns per sample, "
+             << (r.rules ? per_sample / r.rules : 0) << " ns per rule";
+}
+
+} // namespace rules
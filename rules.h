@@ -0,0 +1,141 @@
+#pragma once
+
+#include "report.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Alert rules from the config file, compiled once into a flat program that
+// is evaluated on every sample.
+//
+// rule = <condition> [for <duration> | <n> times in <duration>] -> <action>
+//
+// condition:
+//   <channel> <|<=|>|>=|==|!= <value>   filtered measurement, see below
+//   status <STATUS>                     system_status flag is set
+//   event <INTERRUPT>                   interrupt was raised since last sample
+//   charging, discharging
+//   combined with not, and, or, in that order of precedence
+// channel: charge_percent, battery_voltage_mv, output_voltage_mv,
+//   charge_current_ma, discharge_current_ma
+// duration: number with ms, s, min or h suffix, up to a year
+// action: log | poweroff | hook <absolute path>
+//
+// "for" requires the condition to hold over the whole duration. "times in"
+// counts the samples the condition held in, which suits events.
+
+namespace rules {
+
+enum class action { LOG, HOOK, POWEROFF };
+
+class program {
+public:
+  static constexpr size_t max_instructions = 32; // per rule
+  static constexpr size_t max_stack = 8;         // nesting of a condition
+  static constexpr unsigned max_times = 16;      // n of "n times in"
+
+  struct result {
+    bool poweroff = false; // a poweroff rule is active
+  };
+
+  // Compiled form of a condition, a postfix program for a stack of bools.
+  enum class opcode : uint8_t {
+    LT, LE, GT, GE, EQ, NE, // channel against value
+    STATUS,                 // status & value
+    EVENT,                  // interrupts & value
+    CHARGING,
+    DISCHARGING,
+    NOT,
+    AND,
+    OR
+  };
+
+  struct instruction {
+    opcode op;
+    uint8_t channel;
+    uint32_t value;
+  };
+
+private:
+  enum class window : uint8_t { NONE, FOR, TIMES };
+
+  struct rule {
+    uint32_t first; // into m_code
+    uint32_t length;
+    window kind;
+    uint8_t times;
+    uint32_t hits;  // into m_hits, times entries
+    int64_t window_ms;
+    rules::action action;
+    std::string hook;
+    std::string source;
+
+    // Evaluation state
+    bool held = false;
+    bool active = false;
+    int64_t since_ms = 0;
+    uint8_t hit_count = 0;
+    uint8_t hit_next = 0;
+  };
+
+  std::vector<instruction> m_code;
+  std::vector<rule> m_rules;
+  std::vector<int64_t> m_hits; // timestamps of "times in" hits, ring per rule
+  std::vector<uint32_t> m_fired;
+
+  bool condition(const rule &r, const sample &s) const;
+
+public:
+  program() = default;
+  /// Copies reserve room for every rule to fire, like add() does.
+  program(const program &other);
+  program &operator=(const program &other);
+  program(program &&) = default;
+  program &operator=(program &&) = default;
+
+  /**
+   * Compile a rule and append it to the program.
+   * @throw std::invalid_argument on a syntax error or an invalid hook.
+   */
+  void add(std::string_view source);
+
+  bool empty() const { return m_rules.empty(); }
+  size_t size() const { return m_rules.size(); }
+  bool has_action(action a) const;
+
+  /**
+   * Run every rule against a sample. Doesn't allocate, the cost is bounded
+   * by max_terms per rule.
+   */
+  result evaluate(const sample &s);
+
+  /// Rules that fired during the last evaluate(), as indices.
+  const std::vector<uint32_t> &fired() const { return m_fired; }
+
+  action get_action(uint32_t index) const { return m_rules[index].action; }
+  const std::string &get_hook(uint32_t index) const {
+    return m_rules[index].hook;
+  }
+
+  /// Rule as written in the config file.
+  const std::string &get_source(uint32_t index) const {
+    return m_rules[index].source;
+  }
+};
+
+struct benchmark_result {
+  size_t rules = 0;
+  size_t samples = 0;
+  uint64_t ns = 0;
+};
+
+text::writer &operator<<(text::writer &out, const benchmark_result &r);
+
+/**
+ * Evaluate a few hundred typical rules over synthetic samples.
+ */
+benchmark_result benchmark(size_t rules = 500, size_t samples = 100000);
+
+} // namespace rules
@@ -0,0 +1,505 @@
+#include "simulator.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <stdexcept>
+#include <string_view>
+#include <unistd.h>
+
+#include "sw6106.h"
+
+namespace sim {
+
+using bytes::byte;
+using interrupts = sw6106::interrupts;
+using status = sw6106::system_status;
+
+static const byte interrupts_start = 0x05;
+static const byte interrupts_end = 0x08;
+
+static const byte system_status_register = 0x11;
+static const byte adc_vbat_register = 0x14;
+static const byte adc_vbat_vout_register = 0x15;
+static const byte adc_vout_register = 0x16;
+static const byte adc_ichg_register = 0x17;
+static const byte adc_ichg_idischg_register = 0x18;
+static const byte adc_idischg_register = 0x19;
+static const byte chip_version_register = 0x26;
+static const byte charge_percent_register = 0x4f;
+
+// Open circuit voltage of the cell against state of charge.
+struct ocv_point {
+  double percent;
+  double mv;
+};
+
+static const ocv_point ocv_table[] = {
+    {0, 3000},  {5, 3450},  {10, 3600}, {20, 3700}, {40, 3780},
+    {60, 3880}, {80, 4000}, {90, 4080}, {100, 4200},
+};
+
+static double open_circuit_mv(double percent) {
+  percent = std::clamp(percent, 0., 100.);
+  for (size_t i = 1; i < std::size(ocv_table); ++i) {
+    const ocv_point &a = ocv_table[i - 1];
+    const ocv_point &b = ocv_table[i];
+    if (percent <= b.percent)
+      return a.mv + (b.mv - a.mv) * (percent - a.percent) /
+                        (b.percent - a.percent);
+  }
+
+  return ocv_table[std::size(ocv_table) - 1].mv;
+}
+
+// The boost converter gives up below this.
+static const unsigned cutoff_mv = 2950;
+static const unsigned output_mv = 5000;
+static const double boost_efficiency = 0.9;
+
+// Charge current tapers off linearly from here to full.
+static const double taper_percent = 95;
+
+static const int64_t max_step_ms = 1000;
+
+// Latched over and over during an interrupt storm.
+static const uint32_t storm_interrupts =
+    static_cast<uint32_t>(interrupts::SHORT_CONTROL_KEY_PRESS) |
+    static_cast<uint32_t>(interrupts::PORT_A_CONNECTED) |
+    static_cast<uint32_t>(interrupts::PORT_A_DISCONNECTED);
+
+// Script parsing
+
+namespace {
+
+class script_parser {
+  std::string_view m_line;
+  unsigned m_lineno;
+
+public:
+  script_parser(std::string_view line, unsigned lineno)
+      : m_line(line.substr(0, line.find('#'))), m_lineno(lineno) {}
+
+  [[noreturn]] void fail(const std::string &what) const {
+    throw std::invalid_argument(what + " at line " + std::to_string(m_lineno) +
+                                " of simulator script");
+  }
+
+  std::string_view next() {
+    const size_t start = m_line.find_first_not_of(" \t\r");
+    if (start == std::string_view::npos) {
+      m_line = {};
+      return {};
+    }
+
+    m_line.remove_prefix(start);
+    const size_t end = std::min(m_line.find_first_of(" \t\r"), m_line.size());
+    const std::string_view token = m_line.substr(0, end);
+    m_line.remove_prefix(end);
+
+    return token;
+  }
+
+  bool done() const {
+    return m_line.find_first_not_of(" \t\r") == std::string_view::npos;
+  }
+
+  void expect(std::string_view word) {
+    if (next() != word)
+      fail("Expected \"" + std::string(word) + "\"");
+  }
+
+  unsigned number(unsigned min, unsigned max) {
+    const std::string_view token = next();
+    unsigned value = 0;
+    const auto [end, ec] =
+        std::from_chars(token.data(), token.data() + token.size(), value);
+
+    if (ec != std::errc() || end != token.data() + token.size() ||
+        value < min || value > max)
+      fail("Expected a number between " + std::to_string(min) + " and " +
+           std::to_string(max));
+
+    return value;
+  }
+
+  bool on_off() {
+    const std::string_view token = next();
+    if (token == "on")
+      return true;
+    if (token != "off")
+      fail("Expected on or off");
+
+    return false;
+  }
+
+  int64_t duration_ms() {
+    const std::string_view token = next();
+    int64_t value = 0;
+    const auto [end, ec] =
+        std::from_chars(token.data(), token.data() + token.size(), value);
+    const std::string_view unit(end, token.data() + token.size() - end);
+
+    if (ec == std::errc() && value >= 0) {
+      if (unit == "ms")
+        return value;
+      if (unit == "s")
+        return value * 1000;
+      if (unit == "min")
+        return value * 60 * 1000;
+      if (unit == "h")
+        return value * 60 * 60 * 1000;
+    }
+
+    fail("Expected a time like 500ms, 30s, 5min or 1h");
+  }
+};
+
+std::string read_file(const std::filesystem::path &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::invalid_argument("Failed to open simulator script " +
+                                path.generic_string() + ": " +
+                                strerror(errno));
+
+  std::string content;
+  char buffer[4096];
+
+  while (true) {
+    const ssize_t res = ::read(fd, buffer, sizeof(buffer));
+    if (res < 0 && errno == EINTR)
+      continue;
+
+    if (res <= 0)
+      break;
+
+    content.append(buffer, res);
+  }
+
+  ::close(fd);
+  return content;
+}
+
+} // namespace
+
+script read_script(const std::filesystem::path &path) {
+  script result;
+  if (path.empty())
+    return result;
+
+  const std::string content = read_file(path);
+  std::string_view remaining = content;
+  unsigned lineno = 0;
+
+  while (!remaining.empty()) {
+    const size_t eol = std::min(remaining.find('\n'), remaining.size());
+    script_parser parse(remaining.substr(0, eol), ++lineno);
+    remaining.remove_prefix(std::min(eol + 1, remaining.size()));
+
+    const std::string_view first = parse.next();
+    if (first.empty())
+      continue;
+
+    if (first == "at") {
+      event e;
+      e.at_ms = parse.duration_ms();
+
+      const std::string_view what = parse.next();
+      if (what == "load") {
+        e.type = event::kind::LOAD;
+        e.value = parse.number(0, 5000);
+      } else if (what == "charger") {
+        e.type = event::kind::CHARGER;
+        e.value = parse.on_off();
+      } else if (what == "sag") {
+        e.type = event::kind::SAG;
+        e.value = parse.number(1, 4200);
+        parse.expect("for");
+        e.duration_ms = parse.duration_ms();
+      } else if (what == "nak") {
+        e.type = event::kind::NAK;
+        e.value = parse.number(1, 100);
+        parse.expect("for");
+        e.duration_ms = parse.duration_ms();
+      } else if (what == "storm") {
+        e.type = event::kind::STORM;
+        parse.expect("for");
+        e.duration_ms = parse.duration_ms();
+      } else if (what == "overtemp") {
+        e.type = event::kind::OVERTEMP;
+      } else {
+        parse.fail("Unknown event \"" + std::string(what) + "\"");
+      }
+
+      if (!parse.done())
+        parse.fail("Unexpected text after the event");
+
+      result.events.push_back(e);
+      continue;
+    }
+
+    parse.expect("=");
+
+    if (first == "speed")
+      result.speed = parse.number(1, 1000000);
+    else if (first == "capacity_mah")
+      result.capacity_mah = parse.number(100, 100000);
+    else if (first == "initial_percent")
+      result.initial_percent = parse.number(0, 100);
+    else if (first == "resistance_mohm")
+      result.resistance_mohm = parse.number(0, 2000);
+    else if (first == "load_ma")
+      result.load_ma = parse.number(0, 5000);
+    else if (first == "charge_ma")
+      result.charge_ma = parse.number(0, 5000);
+    else if (first == "charger")
+      result.charger = parse.on_off();
+    else
+      parse.fail("Unknown setting \"" + std::string(first) + "\"");
+
+    if (!parse.done())
+      parse.fail("Unexpected text after the value");
+  }
+
+  std::stable_sort(
+      result.events.begin(), result.events.end(),
+      [](const event &a, const event &b) { return a.at_ms < b.at_ms; });
+
+  return result;
+}
+
+// Device
+
+simulator::simulator(const script &s)
+    : m_script(s), m_started_ns(stats::now_ns()),
+      m_charge_mah(s.capacity_mah * s.initial_percent / 100.),
+      m_load_ma(s.load_ma), m_charger(s.charger),
+      m_percent(s.initial_percent) {
+  m_registers[chip_version_register] = sw6106::expected_chip_version;
+
+  step(0);
+  update_registers();
+
+  // Nothing is pending on power up.
+  m_latched = 0;
+  update_registers();
+}
+
+void simulator::latch(uint32_t i) { m_latched |= i; }
+
+void simulator::apply(const event &e) {
+  switch (e.type) {
+  case event::kind::LOAD:
+    m_load_ma = e.value;
+    break;
+  case event::kind::CHARGER:
+    m_charger = e.value;
+    // Plugging in a charger brings a cut off battery back.
+    if (m_charger)
+      m_cut_off = false;
+    break;
+  case event::kind::SAG:
+    m_sag_mv = e.value;
+    m_sag_until_ms = e.at_ms + e.duration_ms;
+    break;
+  case event::kind::NAK:
+    m_nak_percent = e.value;
+    m_nak_until_ms = e.at_ms + e.duration_ms;
+    break;
+  case event::kind::STORM:
+    m_storm_until_ms = e.at_ms + e.duration_ms;
+    break;
+  case event::kind::OVERTEMP:
+    latch(static_cast<uint32_t>(interrupts::IC_OVER_TEMPERATURE));
+    break;
+  }
+}
+
+void simulator::step(int64_t dt_ms) {
+  const double capacity = m_script.capacity_mah;
+  const double percent = m_charge_mah * 100 / capacity;
+  const double ocv = open_circuit_mv(percent);
+  const double resistance = m_script.resistance_mohm / 1000.;
+
+  // The charger powers the output by itself, the battery only takes the
+  // charge current.
+  const bool boost = m_load_ma > 0 && !m_cut_off;
+  double drain_ma = 0;
+  m_charge_ma = 0;
+
+  if (m_charger) {
+    m_charge_ma = m_script.charge_ma;
+    if (percent >= 100)
+      m_charge_ma = 0;
+    else if (percent > taper_percent)
+      m_charge_ma *= (100 - percent) / (100 - taper_percent);
+  } else if (boost) {
+    drain_ma = m_load_ma * double(output_mv) / (ocv * boost_efficiency);
+  }
+
+  const double hours = dt_ms / 3600000.;
+  m_charge_mah = std::clamp(m_charge_mah + (m_charge_ma - drain_ma) * hours,
+                            0., capacity);
+
+  if (m_now_ms >= m_sag_until_ms)
+    m_sag_mv = 0;
+
+  const double battery_mv =
+      ocv + (m_charge_ma - drain_ma) * resistance - m_sag_mv;
+  m_battery_mv = std::max(battery_mv, 0.);
+
+  const unsigned previous_percent = m_percent;
+  m_percent = std::clamp<unsigned>(m_charge_mah * 100 / capacity + 0.5, 0, 100);
+
+  if (m_percent != previous_percent) {
+    latch(static_cast<uint32_t>(interrupts::CHARGE_PERCENT_CHANGED));
+    if (m_percent < 5 && previous_percent >= 5)
+      latch(static_cast<uint32_t>(interrupts::CHARGE_BELLOW_5_PERCENT));
+    if (m_percent == 100 && m_charger)
+      latch(static_cast<uint32_t>(interrupts::FULLY_CHARGED));
+  }
+
+  if (boost && m_battery_mv < cutoff_mv) {
+    m_cut_off = true;
+    latch(static_cast<uint32_t>(interrupts::BATTERY_VOLTAGE_TOO_LOW));
+  }
+
+  if (m_now_ms < m_storm_until_ms)
+    latch(storm_interrupts);
+}
+
+void simulator::advance() {
+  // Microseconds first, so a high speed doesn't overflow over long runs.
+  const int64_t target_ms =
+      (stats::now_ns() - m_started_ns) / 1000 * m_script.speed / 1000;
+
+  while (m_now_ms < target_ms) {
+    int64_t until = std::min(target_ms, m_now_ms + max_step_ms);
+
+    const bool event_due = m_next_event < m_script.events.size() &&
+                           m_script.events[m_next_event].at_ms <= until;
+    if (event_due)
+      until = std::max(m_script.events[m_next_event].at_ms, m_now_ms);
+
+    step(until - m_now_ms);
+    m_now_ms = until;
+
+    while (m_next_event < m_script.events.size() &&
+           m_script.events[m_next_event].at_ms <= m_now_ms)
+      apply(m_script.events[m_next_event++]);
+
+    update_registers();
+  }
+}
+
+void simulator::update_registers() {
+  byte s = 0;
+  if (m_load_ma > 0)
+    s |= static_cast<byte>(status::PORT_A_CONNECTED);
+  if (m_charger)
+    s |= static_cast<byte>(status::PORT_C_CONNECTED) |
+         static_cast<byte>(status::CHARGER_CONNECTED);
+  if (m_load_ma > 0 && !m_cut_off)
+    s |= static_cast<byte>(status::BOOST_CONVERTER_ENABLED);
+
+  // Transitions raise their interrupts like the chip does.
+  const byte changed = s ^ m_registers[system_status_register];
+  auto edge = [&](status bit, interrupts on, interrupts off) {
+    if (changed & static_cast<byte>(bit))
+      latch(static_cast<uint32_t>(s & static_cast<byte>(bit) ? on : off));
+  };
+  edge(status::PORT_A_CONNECTED, interrupts::PORT_A_CONNECTED,
+       interrupts::PORT_A_DISCONNECTED);
+  edge(status::PORT_C_CONNECTED, interrupts::PORT_C_CONNECTED,
+       interrupts::PORT_C_DISCONNECTED);
+  edge(status::CHARGER_CONNECTED, interrupts::CHARGER_ENABLED,
+       interrupts::CHARGER_DISABLED);
+  edge(status::BOOST_CONVERTER_ENABLED, interrupts::BOOST_CONVERTER_ENABLED,
+       interrupts::BOOST_CONVERTER_DISABLED);
+
+  m_registers[system_status_register] = s;
+  m_registers[charge_percent_register] = m_percent;
+
+  for (byte r = interrupts_start; r <= interrupts_end; ++r)
+    m_registers[r] = m_latched >> (8 * (r - interrupts_start));
+
+  // The inverse of the conversions in sw6106.cpp. Battery voltage and
+  // currents read as 0 when idle, same as on the real thing.
+  const bool idle = s == 0;
+  const bool boost = s & static_cast<byte>(status::BOOST_CONVERTER_ENABLED);
+
+  const unsigned vbat = idle ? 0 : std::min(m_battery_mv * 10 / 12, 0xfffu);
+  const unsigned vout =
+      boost ? std::min((output_mv - m_load_ma / 10) / 4, 0xfffu) : 0;
+
+  const unsigned ichg = std::min(unsigned(m_charge_ma * 7 / 25), 0xfffu);
+  const unsigned idischg = boost ? std::min(m_load_ma * 7 / 25, 0xfffu) : 0;
+
+  m_registers[adc_vbat_register] = vbat & 0xff;
+  m_registers[adc_vout_register] = vout & 0xff;
+  m_registers[adc_vbat_vout_register] = (vbat >> 8) | ((vout >> 8) << 4);
+  m_registers[adc_ichg_register] = ichg & 0xff;
+  m_registers[adc_idischg_register] = idischg & 0xff;
+  m_registers[adc_ichg_idischg_register] =
+      (ichg >> 8) | ((idischg >> 8) << 4);
+}
+
+int simulator::transfer(i2c_msg *messages, unsigned count) {
+  advance();
+
+  if (m_now_ms < m_nak_until_ms) {
+    // Deterministic, so a run can be repeated.
+    m_random = m_random * 1103515245 + 12345;
+    if ((m_random >> 16) % 100 < m_nak_percent)
+      return ENXIO;
+  }
+
+  byte pointer = 0;
+  for (unsigned i = 0; i < count; ++i) {
+    i2c_msg &msg = messages[i];
+    if (msg.addr != sw6106::i2c_address)
+      return ENXIO;
+
+    if (msg.flags & I2C_M_RD) {
+      for (unsigned n = 0; n < msg.len; ++n)
+        msg.buf[n] = m_registers[pointer++];
+      continue;
+    }
+
+    if (msg.len == 0)
+      continue;
+
+    pointer = msg.buf[0];
+    for (unsigned n = 1; n < msg.len; ++n, ++pointer) {
+      const byte value = msg.buf[n];
+
+      if (pointer >= interrupts_start && pointer <= interrupts_end) {
+        // Write 1 to clear.
+        m_latched &= ~(uint32_t(value) << (8 * (pointer - interrupts_start)));
+        m_registers[pointer] &= ~value;
+      } else if (pointer < system_status_register) {
+        // Masks and the like. There is no interrupt line to mask, the
+        // values are just kept.
+        m_registers[pointer] = value;
+      }
+      // Status, ADC and the rest are read only.
+    }
+  }
+
+  return 0;
+}
+
+std::unique_ptr<i2c::bus> open(const std::string &device) {
+  static const std::string prefix = "sim:";
+  if (!device.starts_with(prefix))
+    throw std::invalid_argument(device + " is not a simulated device");
+
+  return std::make_unique<simulator>(
+      read_script(device.substr(prefix.size())));
+}
+
+} // namespace sim
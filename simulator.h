@@ -0,0 +1,115 @@
+#pragma once
+
+#include "i2c.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A simulated sw6106 behind a pseudo adapter, for reproducing incidents and
+// load testing without hardware. Open "sim:" or "sim:<script>" as the i2c
+// device.
+//
+// The register file is emulated: status 0x11, interrupt latches 0x05-0x08
+// (write 1 to clear) with their masks 0x09-0x0d, the ADC registers
+// 0x14-0x19, chip version 0x26 and charge percent 0x4f. Behind it a single
+// Li-ion cell is charged and discharged, and simulated time can run many
+// times faster than real time.
+//
+// Script, one setting or event per line, '#' starts a comment:
+//   speed = 3600            simulated seconds per real second
+//   capacity_mah = 2000
+//   initial_percent = 100
+//   resistance_mohm = 120   cell internal resistance
+//   load_ma = 500           drawn from the 5 V output
+//   charge_ma = 1000
+//   charger = off
+//   at <time> load <ma>
+//   at <time> charger on|off
+//   at <time> sag <mv> for <duration>       cell voltage sags
+//   at <time> nak <percent> for <duration>  transfers fail with ENXIO
+//   at <time> storm for <duration>          interrupts latched nonstop
+//   at <time> overtemp                      IC_OVER_TEMPERATURE once
+// Times and durations take ms, s, min or h and are in simulated time.
+
+namespace sim {
+
+struct event {
+  enum class kind { LOAD, CHARGER, SAG, NAK, STORM, OVERTEMP };
+
+  int64_t at_ms = 0;
+  kind type = kind::LOAD;
+  unsigned value = 0;
+  int64_t duration_ms = 0;
+};
+
+struct script {
+  unsigned speed = 1;
+  unsigned capacity_mah = 2000;
+  unsigned initial_percent = 100;
+  unsigned resistance_mohm = 120;
+  unsigned load_ma = 500;
+  unsigned charge_ma = 1000;
+  bool charger = false;
+
+  std::vector<event> events; // sorted by time
+};
+
+/**
+ * Load a simulator script.
+ * @param path script file, an empty path gives the defaults.
+ * @throw std::invalid_argument on errors, with the line number.
+ */
+script read_script(const std::filesystem::path &path);
+
+/**
+ * Open the simulator a "sim:[script]" device stands for.
+ * @throw std::invalid_argument on errors in the script.
+ */
+std::unique_ptr<i2c::bus> open(const std::string &device);
+
+class simulator : public i2c::bus {
+  script m_script;
+  size_t m_next_event = 0;
+
+  bytes::byte m_registers[256] = {};
+  uint32_t m_latched = 0;
+
+  uint64_t m_started_ns;
+  int64_t m_now_ms = 0;
+
+  // Battery model
+  double m_charge_mah;
+  unsigned m_load_ma;
+  bool m_charger;
+  bool m_cut_off = false;
+  unsigned m_percent;
+  unsigned m_battery_mv = 0;
+  double m_charge_ma = 0;
+
+  // Faults in progress
+  unsigned m_sag_mv = 0;
+  int64_t m_sag_until_ms = 0;
+  unsigned m_nak_percent = 0;
+  int64_t m_nak_until_ms = 0;
+  int64_t m_storm_until_ms = 0;
+  uint32_t m_random = 1;
+
+  void advance();
+  void step(int64_t dt_ms);
+  void apply(const event &e);
+  void latch(uint32_t interrupts);
+  void update_registers();
+
+public:
+  explicit simulator(const script &s);
+
+  int transfer(i2c_msg *messages, unsigned count) override;
+
+  /// Simulated time since start.
+  int64_t now_ms() const { return m_now_ms; }
+};
+
+} // namespace sim
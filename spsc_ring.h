@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded lock-free single-producer/single-consumer queue.
+ *
+ * The producer never blocks: if the consumer falls behind, push() fails and
+ * the caller decides what to do with the element. The consumer may either
+ * poll with pop() or sleep in wait() until something arrives.
+ */
+template <typename T, size_t capacity> class spsc_ring {
+  static_assert(capacity != 0 && (capacity & (capacity - 1)) == 0,
+                "spsc_ring capacity must be a power of two");
+
+  // Indices are free running and only masked on access, so full and empty
+  // states can be told apart without wasting a slot.
+  alignas(64) std::atomic<size_t> m_head{0}; // next slot to write, producer
+  alignas(64) std::atomic<size_t> m_tail{0}; // next slot to read, consumer
+  alignas(64) std::atomic<uint32_t> m_signal{0};
+  std::atomic_bool m_closed{false};
+
+  std::array<T, capacity> m_slots{};
+
+public:
+  bool push(const T &value) {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == capacity)
+      return false;
+
+    m_slots[head & (capacity - 1)] = value;
+    m_head.store(head + 1, std::memory_order_release);
+
+    m_signal.fetch_add(1, std::memory_order_release);
+    m_signal.notify_one();
+    return true;
+  }
+
+  bool pop(T &value) {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load(std::memory_order_acquire))
+      return false;
+
+    value = m_slots[tail & (capacity - 1)];
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool empty() const {
+    return m_tail.load(std::memory_order_acquire) ==
+           m_head.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Block the consumer until there is something to pop or the queue is
+   * closed. May return spuriously.
+   */
+  void wait() const {
+    const uint32_t signal = m_signal.load(std::memory_order_acquire);
+    if (empty() && !closed())
+      m_signal.wait(signal, std::memory_order_acquire);
+  }
+
+  /**
+   * Producer side: no more elements will follow. Everything pushed before
+   * is still delivered.
+   */
+  void close() {
+    m_closed.store(true, std::memory_order_release);
+    m_signal.fetch_add(1, std::memory_order_release);
+    m_signal.notify_all();
+  }
+
+  bool closed() const { return m_closed.load(std::memory_order_acquire); }
+};
@@ -0,0 +1,77 @@
+#include "state_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+
+state_file::state_file(const std::filesystem::path &path)
+    : m_path(path), m_temporary(path.generic_string() + ".new") {
+  // For making the rename durable.
+  const auto dir = path.has_parent_path() ? path.parent_path() : ".";
+  m_dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (m_dir_fd < 0)
+    throw std::runtime_error("Failed to open " + dir.generic_string() +
+                             " for " + path.generic_string() + ": " +
+                             strerror(errno));
+}
+
+state_file::~state_file() { ::close(m_dir_fd); }
+
+static bool write_all(int fd, std::span<const bytes::byte> data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    const ssize_t res = ::write(fd, data.data() + done, data.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      return false;
+    done += res;
+  }
+
+  return true;
+}
+
+bool state_file::write(std::span<const bytes::byte> image) {
+  const int fd = ::open(m_temporary.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+
+  const bool written = write_all(fd, image) && fsync(fd) == 0;
+  const int err = errno;
+  ::close(fd);
+
+  if (!written) {
+    errno = err;
+    return false;
+  }
+
+  if (rename(m_temporary.c_str(), m_path.c_str()) != 0)
+    return false;
+
+  fsync(m_dir_fd);
+  return true;
+}
+
+size_t read_state_file(const std::filesystem::path &path,
+                       std::span<bytes::byte> image) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open " + path.generic_string() + ": " +
+                             strerror(errno));
+
+  size_t done = 0;
+  while (done < image.size()) {
+    const ssize_t res = ::read(fd, image.data() + done, image.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    done += res;
+  }
+  ::close(fd);
+
+  return done;
+}
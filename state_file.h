@@ -0,0 +1,44 @@
+#pragma once
+
+#include "byte_util.h"
+
+#include <filesystem>
+#include <span>
+
+// Small state files the daemon keeps across restarts, like the energy
+// ledger. They are rewritten as a whole into a temporary file next to them
+// and renamed into place, so a power cut leaves either the previous or the
+// new version, never a mix.
+
+class state_file {
+  std::filesystem::path m_path;
+  std::filesystem::path m_temporary;
+  int m_dir_fd = -1;
+
+public:
+  /**
+   * @throw std::runtime_error if the directory of the file can't be opened.
+   */
+  explicit state_file(const std::filesystem::path &path);
+  ~state_file();
+
+  state_file(const state_file &) = delete;
+  state_file &operator=(const state_file &) = delete;
+
+  /**
+   * Replace the file with image, durably: the data is on disk before the
+   * rename, the rename before returning.
+   * @return false with errno set on failure, the previous file is kept.
+   */
+  bool write(std::span<const bytes::byte> image);
+
+  const std::filesystem::path &path() const { return m_path; }
+};
+
+/**
+ * Read a state file into image.
+ * @return bytes read, at most image.size().
+ * @throw std::runtime_error if the file can't be opened.
+ */
+size_t read_state_file(const std::filesystem::path &path,
+                       std::span<bytes::byte> image);
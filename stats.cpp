@@ -0,0 +1,228 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <bit>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace stats {
+
+uint64_t now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+histogram i2c_read;
+histogram i2c_write;
+counter i2c_errors;
+counter i2c_retries;
+counter i2c_reopens;
+counter i2c_recovered;
+counter i2c_failures;
+
+histogram read_interrupts;
+counter adc_tears;
+counter adc_inconsistent;
+
+histogram edge_to_handled;
+histogram edge_to_report;
+
+histogram phase_acquire;
+histogram phase_wait;
+histogram phase_settle;
+histogram phase_report;
+histogram queue_latency;
+histogram wakeup_jitter;
+counter wakeups;
+counter cycles;
+counter gpio_events;
+counter dropped_reports;
+counter failed_cycles;
+counter filter_rejections;
+counter heap_allocations;
+
+#if SW6106_STATS
+
+// Close enough to the start of the process.
+static const uint64_t started_ns = now_ns();
+
+void histogram::record(uint64_t ns) {
+  unsigned n = std::bit_width(ns);
+  if (n > 0)
+    --n;
+  if (n >= bucket_count)
+    n = bucket_count - 1;
+
+  m_buckets[n].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sum_ns.fetch_add(ns, std::memory_order_relaxed);
+
+  uint64_t max = m_max_ns.load(std::memory_order_relaxed);
+  while (ns > max && !m_max_ns.compare_exchange_weak(
+                         max, ns, std::memory_order_relaxed))
+    ;
+}
+
+#endif
+
+namespace {
+
+// Nothing in a signal handler may allocate or lock, so the dump is formatted
+// by hand into a fixed buffer.
+class fd_writer {
+  int m_fd;
+  char m_buffer[512];
+  size_t m_size = 0;
+
+public:
+  fd_writer(int fd) : m_fd(fd) {}
+  ~fd_writer() { flush(); }
+
+  void flush() {
+    size_t done = 0;
+    while (done < m_size) {
+      ssize_t res = ::write(m_fd, m_buffer + done, m_size - done);
+      if (res <= 0)
+        break;
+      done += res;
+    }
+    m_size = 0;
+  }
+
+  fd_writer &operator<<(const char *str) {
+    while (*str) {
+      if (m_size == sizeof(m_buffer))
+        flush();
+      m_buffer[m_size++] = *str++;
+    }
+    return *this;
+  }
+
+  fd_writer &operator<<(uint64_t value) {
+    char digits[21];
+    char *p = digits + sizeof(digits) - 1;
+    *p = '\0';
+    do {
+      *--p = '0' + value % 10;
+      value /= 10;
+    } while (value);
+
+    return *this << p;
+  }
+};
+
+#if SW6106_STATS
+
+void write_duration(fd_writer &out, uint64_t ns) {
+  if (ns < 10000)
+    out << ns << " ns";
+  else if (ns < 10000000)
+    out << ns / 1000 << " us";
+  else
+    out << ns / 1000000 << " ms";
+}
+
+void write_counter(fd_writer &out, const char *name, const counter &c) {
+  out << name << ": " << c.value() << "\n";
+}
+
+void write_histogram(fd_writer &out, const char *name, const histogram &h) {
+  const uint64_t count = h.count();
+  out << name << ": " << count << " samples";
+  if (count == 0) {
+    out << "\n";
+    return;
+  }
+
+  out << ", avg ";
+  write_duration(out, h.sum_ns() / count);
+  out << ", max ";
+  write_duration(out, h.max_ns());
+  out << "\n";
+
+  for (unsigned n = 0; n < histogram::bucket_count; ++n) {
+    const uint64_t in_bucket = h.bucket(n);
+    if (in_bucket == 0)
+      continue;
+
+    out << "\t< ";
+    write_duration(out, 2ULL << n);
+    out << ": " << in_bucket << "\n";
+  }
+}
+
+uint64_t to_ms(const timeval &tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+void write_per_hour(fd_writer &out, uint64_t value, const char *unit,
+                    uint64_t uptime_ms) {
+  out << ", " << value * 3600000 / uptime_ms << unit << " per hour\n";
+}
+
+// What the daemon costs the system by itself.
+void write_process(fd_writer &out) {
+  const uint64_t uptime_ms =
+      std::max<uint64_t>((now_ns() - started_ns) / 1000000, 1);
+
+  // Not on the async-signal-safe list, but a plain system call on Linux.
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+
+  const uint64_t user_ms = to_ms(usage.ru_utime);
+  const uint64_t system_ms = to_ms(usage.ru_stime);
+  const uint64_t voluntary = usage.ru_nvcsw;
+  const uint64_t involuntary = usage.ru_nivcsw;
+
+  out << "uptime: " << uptime_ms / 1000 << " s\n";
+  out << "acquisition wakeups: " << wakeups.value();
+  write_per_hour(out, wakeups.value(), "", uptime_ms);
+  out << "context switches: " << voluntary << " voluntary, " << involuntary
+      << " involuntary";
+  write_per_hour(out, voluntary + involuntary, "", uptime_ms);
+  out << "cpu time: " << user_ms << " ms user, " << system_ms << " ms system";
+  write_per_hour(out, user_ms + system_ms, " ms", uptime_ms);
+}
+
+#endif
+
+} // namespace
+
+void dump(int fd) {
+  fd_writer out(fd);
+
+#if SW6106_STATS
+  out << "\n----- statistics -----\n";
+  write_histogram(out, "i2c read", i2c_read);
+  write_histogram(out, "i2c write", i2c_write);
+  write_counter(out, "i2c errors", i2c_errors);
+  write_counter(out, "i2c retries", i2c_retries);
+  write_counter(out, "i2c adapter reopens", i2c_reopens);
+  write_counter(out, "i2c recovered transactions", i2c_recovered);
+  write_counter(out, "i2c failed transactions", i2c_failures);
+  write_histogram(out, "read interrupts", read_interrupts);
+  write_counter(out, "adc tears", adc_tears);
+  write_counter(out, "adc reads out of retries", adc_inconsistent);
+  write_histogram(out, "edge to handled", edge_to_handled);
+  write_histogram(out, "edge to report", edge_to_report);
+  write_histogram(out, "acquire phase", phase_acquire);
+  write_histogram(out, "wait phase", phase_wait);
+  write_histogram(out, "settle phase", phase_settle);
+  write_histogram(out, "report phase", phase_report);
+  write_histogram(out, "sample to report", queue_latency);
+  write_histogram(out, "wakeup jitter", wakeup_jitter);
+  write_counter(out, "cycles", cycles);
+  write_counter(out, "gpio events", gpio_events);
+  write_counter(out, "dropped reports", dropped_reports);
+  write_counter(out, "cycles skipped after i2c failures", failed_cycles);
+  write_counter(out, "filter rejections", filter_rejections);
+  write_counter(out, "heap allocations after startup", heap_allocations);
+  write_process(out);
+#else
+  out << "Statistics are disabled in this build\n";
+#endif
+}
+
+} // namespace stats
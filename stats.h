@@ -0,0 +1,126 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Low overhead counters and latency histograms. Everything here compiles to
+// empty inline functions when SW6106_STATS is 0.
+
+#ifndef SW6106_STATS
+#define SW6106_STATS 1
+#endif
+
+namespace stats {
+
+/**
+ * CLOCK_MONOTONIC time in nanoseconds.
+ */
+uint64_t now_ns();
+
+#if SW6106_STATS
+
+class counter {
+  std::atomic<uint64_t> m_value{0};
+
+public:
+  void add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Latency histogram with power of two buckets: bucket N counts durations in
+ * [2^N, 2^(N+1)) nanoseconds. Recording is lock and allocation free.
+ */
+class histogram {
+public:
+  static constexpr unsigned bucket_count = 40; // Up to ~18 minutes
+
+private:
+  std::array<std::atomic<uint64_t>, bucket_count> m_buckets{};
+  std::atomic<uint64_t> m_count{0};
+  std::atomic<uint64_t> m_sum_ns{0};
+  std::atomic<uint64_t> m_max_ns{0};
+
+public:
+  void record(uint64_t ns);
+
+  uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+  uint64_t sum_ns() const { return m_sum_ns.load(std::memory_order_relaxed); }
+  uint64_t max_ns() const { return m_max_ns.load(std::memory_order_relaxed); }
+  uint64_t bucket(unsigned n) const {
+    return m_buckets[n].load(std::memory_order_relaxed);
+  }
+};
+
+class scoped_timer {
+  histogram &m_histogram;
+  uint64_t m_start;
+
+public:
+  scoped_timer(histogram &h) : m_histogram(h), m_start(now_ns()) {}
+  ~scoped_timer() { m_histogram.record(now_ns() - m_start); }
+};
+
+#else
+
+class counter {
+public:
+  void add(uint64_t = 1) {}
+  uint64_t value() const { return 0; }
+};
+
+class histogram {
+public:
+  void record(uint64_t) {}
+};
+
+class scoped_timer {
+public:
+  scoped_timer(histogram &) {}
+};
+
+#endif
+
+// i2c::controller
+extern histogram i2c_read;
+extern histogram i2c_write;
+extern counter i2c_errors;    // Failed attempts
+extern counter i2c_retries;
+extern counter i2c_reopens;   // Adapter file reopened
+extern counter i2c_recovered; // Transactions that succeeded on a retry
+extern counter i2c_failures;  // Transactions given up on
+
+// sw6106
+extern histogram read_interrupts;
+extern counter adc_tears;        // ADC channels that changed mid read
+extern counter adc_inconsistent; // Reads that ran out of retries
+
+// GPIO edge to interrupt registers read, and to the report written out
+extern histogram edge_to_handled;
+extern histogram edge_to_report;
+
+// Main loop phases
+extern histogram phase_acquire;
+extern histogram phase_wait;
+extern histogram phase_settle;
+extern histogram phase_report;
+extern histogram queue_latency;
+extern histogram wakeup_jitter;
+extern counter wakeups; // Of the acquisition loop, from any wait
+extern counter cycles;
+extern counter gpio_events;
+extern counter dropped_reports;
+extern counter failed_cycles; // Skipped after an i2c failure
+extern counter filter_rejections; // Outliers dropped by the ADC filters
+extern counter heap_allocations; // After initialization, see heap_guard
+
+/**
+ * Write every counter and histogram to a file descriptor in a human readable
+ * form, followed by the CPU time and context switches of the process, per
+ * hour of uptime. Async-signal-safe, so it can be called straight from a
+ * signal handler.
+ */
+void dump(int fd);
+
+} // namespace stats
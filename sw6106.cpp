@@ -1,4 +1,5 @@
 #include "sw6106.h"
+#include "stats.h"
 
 using bytes::byte;
 
@@ -6,8 +7,6 @@ using bytes::byte;
 NOTICE! This device can only read/write one byte per transaction -_-
 This means no fancy multi-byte reading and parsing in one go.
 */
-static const byte sw6106_i2c_address = 0x3c;
-
 static const byte interrupts_start = 0x05;
 static const byte interrupts_end = 0x08;
 
@@ -27,77 +26,8 @@ static const byte adc_idischg_register = 0x19;
 static const byte chip_version_register = 0x26;
 static const byte charge_percent_register = 0x4f;
 
-template <class E>
-std::string
-bitflag_enum_to_string(const E val,
-                       const std::map<E, std::string> &descriptions) {
-  std::stringstream out;
-  for (const auto &desc : descriptions) {
-    // Very much type safe, as safe as it could possibly get.
-    if (static_cast<std::underlying_type<E>::type>(val) &
-        static_cast<std::underlying_type<E>::type>(desc.first)) {
-      if (out.tellp() != std::streampos(0))
-        out << '\n';
-      out << '\t' << desc.second;
-    }
-  }
-
-  return out.str();
-}
-
-const std::map<sw6106::system_status, std::string>
-    sw6106::system_status_descriptions{
-        {sw6106::system_status::PORT_A_CONNECTED,
-         "USB type A port is connected"},
-        {sw6106::system_status::PORT_MICRO_CONNECTED,
-         "Micro USB port is connected"},
-        {sw6106::system_status::PORT_C_CONNECTED,
-         "USB type C port is connected"},
-        {sw6106::system_status::CHARGER_CONNECTED, "Charger is connected"},
-        {sw6106::system_status::BOOST_CONVERTER_ENABLED,
-         "Boost converter is enabled"},
-    };
-
-const std::map<sw6106::interrupts, std::string> sw6106::interrupts_descriptions{
-    {sw6106::interrupts::SHORT_CIRCUIT, "Short circuit protection triggered"},
-    {sw6106::interrupts::IC_OVER_TEMPERATURE,
-     "Integrated circuit overtemperature protection triggered"},
-    {sw6106::interrupts::BATTERY_OVER_TEMPERATURE,
-     "Battery overtemperature protection triggered"},
-    {sw6106::interrupts::BATTERY_VOLTAGE_TOO_LOW, "Battery voltage is too low"},
-    {sw6106::interrupts::CHARGE_TIMEOUT, "Battery charging is taking too long"},
-    {sw6106::interrupts::MICRO_USB_OVERVOLTAGE,
-     "Voltage on Micro USB port is too high"},
-    {sw6106::interrupts::TYPE_C_OVERVOLTAGE,
-     "Voltage on Type C port is too high"},
-    {sw6106::interrupts::BATTERY_VOLTAGE_TOO_HIGH,
-     "Battery voltage is too high"},
-    {sw6106::interrupts::PORT_A_CONNECTED, "USB type A port is connected"},
-    {sw6106::interrupts::PORT_A_DISCONNECTED,
-     "USB type A port is disconnected"},
-    {sw6106::interrupts::PORT_MICRO_CONNECTED, "Micro USB port is connected"},
-    {sw6106::interrupts::PORT_MICRO_DISCONNECTED,
-     "Micro USB port is disconnected"},
-    {sw6106::interrupts::PORT_C_CONNECTED, "USB type C port is connected"},
-    {sw6106::interrupts::PORT_C_DISCONNECTED,
-     "USB type C port is disconnected"},
-    {sw6106::interrupts::SHORT_CONTROL_KEY_PRESS,
-     "Control key has been pressed shortly"},
-    {sw6106::interrupts::FAST_CHARGE_STATUS_CHANGED,
-     "Fast charge status changed"},
-    {sw6106::interrupts::CHARGE_PERCENT_CHANGED, "Charge percent changed"},
-    {sw6106::interrupts::BOOST_CONVERTER_DISABLED, "Boost converter disabled"},
-    {sw6106::interrupts::BOOST_CONVERTER_ENABLED, "Boost converter enabled"},
-    {sw6106::interrupts::CHARGER_DISABLED, "Charging disabled"},
-    {sw6106::interrupts::CHARGER_ENABLED, "Charging enabled"},
-    {sw6106::interrupts::CHARGE_BELLOW_5_PERCENT,
-     "Charge level is bellow 5 percent"},
-    {sw6106::interrupts::FULLY_CHARGED, "Battery is fully charged"},
-    {sw6106::interrupts::WLED_STATE_CHANGED, "WLED state changed"},
-};
-
 sw6106::sw6106(i2c::controller::ptr controller)
-    : i2c::peripheral(controller, sw6106_i2c_address) {}
+    : i2c::peripheral(controller, i2c_address) {}
 
 void sw6106::enable_interrupts(const interrupts &i) {
   uint32_t interrupts = static_cast<uint32_t>(i);
@@ -127,6 +57,8 @@ void sw6106::enable_interrupts(const interrupts &i) {
 }
 
 sw6106::interrupts sw6106::read_interrupts() {
+  stats::scoped_timer timer(stats::read_interrupts);
+
   uint32_t result = 0;
   for (byte b = interrupts_end; b >= interrupts_start; --b) {
     byte value = read(b);
@@ -141,6 +73,17 @@ sw6106::interrupts sw6106::read_interrupts() {
   return static_cast<sw6106::interrupts>(result);
 }
 
+sw6106::interrupt_event
+sw6106::read_interrupts(std::chrono::nanoseconds edge_timestamp) {
+  interrupt_event event;
+  event.flags = read_interrupts();
+  event.handled = std::chrono::nanoseconds(stats::now_ns());
+  event.timestamp =
+      edge_timestamp.count() != 0 ? edge_timestamp : event.handled;
+
+  return event;
+}
+
 sw6106::system_status sw6106::get_system_status() {
   return system_status{
       static_cast<system_status>(read(system_status_register))};
@@ -164,20 +107,55 @@ unsigned sw6106::get_battery_voltage_mv() {
   return voltage_mv;
 }
 
-unsigned int sw6106::get_output_voltage_mv() {
+unsigned sw6106::output_adc::output_voltage_mv() const {
   /*
   Rebuild voltage in millivolts according to formula provided in i2c
   register map: Vout = ((Reg0x15[7:4]<<8) + Reg0x16[7:0]) * 4 mV
   */
-  uint16_t voltage_mv = read(adc_vbat_vout_register);
+  uint16_t voltage_mv = vbat_vout_high;
   voltage_mv &= 0xf0;
   voltage_mv <<= 4;
-  voltage_mv += read(adc_vout_register);
+  voltage_mv += vout_low;
   voltage_mv *= 4;
 
   return voltage_mv;
 }
 
+unsigned sw6106::output_adc::discharge_current_ma() const {
+  /*
+  Rebuild amperage in milliamps according to formula provided in i2c
+  register map:  IDischarge = ((Reg0x18[7:4] << 8) + Reg0x19[7:0])* 25 / 7 mA
+  */
+
+  static const double idischg_conversion_coeff = 25. / 7.;
+
+  uint16_t amps_ma = ichg_idischg_high;
+  amps_ma &= 0xf0;
+  amps_ma <<= 4;
+  amps_ma += idischg_low;
+  amps_ma *= idischg_conversion_coeff;
+
+  return amps_ma;
+}
+
+sw6106::output_adc sw6106::read_output_adc() {
+  output_adc result;
+  result.vbat_vout_high = read(adc_vbat_vout_register);
+  result.vout_low = read(adc_vout_register);
+  result.ichg_idischg_high = read(adc_ichg_idischg_register);
+  result.idischg_low = read(adc_idischg_register);
+
+  return result;
+}
+
+unsigned int sw6106::get_output_voltage_mv() {
+  output_adc raw;
+  raw.vbat_vout_high = read(adc_vbat_vout_register);
+  raw.vout_low = read(adc_vout_register);
+
+  return raw.output_voltage_mv();
+}
+
 unsigned int sw6106::get_charge_current_ma() {
   /*
   Rebuild amperage in milliamps according to formula provided in i2c
@@ -196,34 +174,110 @@ unsigned int sw6106::get_charge_current_ma() {
 }
 
 unsigned int sw6106::get_discharge_current_ma() {
-  /*
-  Rebuild amperage in milliamps according to formula provided in i2c
-  register map:  IDischarge = ((Reg0x18[7:4] << 8) + Reg0x19[7:0])* 25 / 7 mA
-  */
+  output_adc raw;
+  raw.ichg_idischg_high = read(adc_ichg_idischg_register);
+  raw.idischg_low = read(adc_idischg_register);
 
-  static const double idischg_conversion_coeff = 25. / 7.;
+  return raw.discharge_current_ma();
+}
 
-  uint16_t amps_ma = read(adc_ichg_idischg_register);
-  amps_ma &= 0xf0;
-  amps_ma <<= 4;
-  amps_ma += read(adc_idischg_register);
-  amps_ma *= idischg_conversion_coeff;
+// Two channels sharing a high register, the first in its lower nibble.
+struct sw6106::adc_pair {
+  byte high;
+  byte low[2];
+  unsigned first; // index into m_last_adc, and bit in adc_channels
+};
 
-  return amps_ma;
+bool sw6106::read_adc_pair(const adc_pair &pair, unsigned channels,
+                           adc_reading &reading) {
+  const bool wanted[2] = {(channels >> pair.first & 1) != 0,
+                          (channels >> (pair.first + 1) & 1) != 0};
+  if (!wanted[0] && !wanted[1])
+    return true;
+
+  byte high = read(pair.high);
+  byte low[2] = {};
+  ++reading.reads;
+
+  for (unsigned attempt = 0; attempt <= adc_retry_budget; ++attempt) {
+    for (unsigned i = 0; i < 2; ++i)
+      if (wanted[i]) {
+        low[i] = read(pair.low[i]);
+        ++reading.reads;
+      }
+
+    const byte check = read(pair.high);
+    ++reading.reads;
+
+    if (check == high) {
+      for (unsigned i = 0; i < 2; ++i)
+        if (wanted[i]) {
+          m_last_adc[pair.first + i] = ((high >> (4 * i)) & 0x0f) << 8 | low[i];
+          m_adc_valid |= 1u << (pair.first + i);
+        }
+
+      return true;
+    }
+
+    // The reread is as fresh as it gets, it starts the next attempt.
+    ++reading.tears;
+    high = check;
+  }
+
+  // Off by a high bit at worst, still better than reading 0.
+  for (unsigned i = 0; i < 2; ++i)
+    if (wanted[i] && !(m_adc_valid >> (pair.first + i) & 1))
+      m_last_adc[pair.first + i] = ((high >> (4 * i)) & 0x0f) << 8 | low[i];
+
+  return false;
 }
 
-std::ostream &operator<<(std::ostream &out, const sw6106::system_status &s) {
-  if (s == sw6106::system_status::NONE)
-    out << "\tIdle";
-  else
-    out << bitflag_enum_to_string(s, sw6106::system_status_descriptions);
+sw6106::adc_reading sw6106::read_adc(adc_channels channels) {
+  static const adc_pair adc_pairs[] = {
+      {adc_vbat_vout_register, {adc_vbat_register, adc_vout_register}, 0},
+      {adc_ichg_idischg_register, {adc_ichg_register, adc_idischg_register}, 2},
+  };
+
+  adc_reading result;
+  for (const auto &pair : adc_pairs)
+    if (!read_adc_pair(pair, static_cast<unsigned>(channels), result))
+      result.consistent = false;
 
-  return out;
+  stats::adc_tears.add(result.tears);
+  if (!result.consistent)
+    stats::adc_inconsistent.add();
+
+  // Same conversions as the individual getters, see there.
+  auto wanted = [channels](adc_channels c) {
+    return static_cast<unsigned>(channels) & static_cast<unsigned>(c);
+  };
+
+  if (wanted(adc_channels::BATTERY_VOLTAGE))
+    result.battery_voltage_mv = static_cast<uint16_t>(m_last_adc[0] * 1.2);
+
+  if (wanted(adc_channels::OUTPUT_VOLTAGE))
+    result.output_voltage_mv = m_last_adc[1] * 4;
+
+  if (wanted(adc_channels::CHARGE_CURRENT))
+    result.charge_current_ma = static_cast<uint16_t>(m_last_adc[2] * 25. / 7.);
+
+  if (wanted(adc_channels::DISCHARGE_CURRENT))
+    result.discharge_current_ma =
+        static_cast<uint16_t>(m_last_adc[3] * 25. / 7.);
+
+  return result;
 }
 
-std::ostream &operator<<(std::ostream &out, const sw6106::interrupts &i) {
-  if (i != sw6106::interrupts::NONE)
-    out << bitflag_enum_to_string(i, sw6106::interrupts_descriptions);
+sw6106::snapshot sw6106::get_snapshot() {
+  snapshot result;
+  result.status = get_system_status();
+  result.charge_percent = get_charge_percent();
+
+  const auto adc = read_adc();
+  result.battery_voltage_mv = adc.battery_voltage_mv;
+  result.output_voltage_mv = adc.output_voltage_mv;
+  result.charge_current_ma = adc.charge_current_ma;
+  result.discharge_current_ma = adc.discharge_current_ma;
 
-  return out;
+  return result;
 }
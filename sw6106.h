@@ -1,14 +1,31 @@
 #pragma once
 
 #include "i2c.h"
+#include "text.h"
 
+#include <chrono>
 #include <map>
 #include <string>
 
+#if !SW6106_LEAN
+#include <ostream>
+#endif
+
 class sw6106 : protected i2c::peripheral {
   using byte = bytes::byte;
 
+  /// Raw values of the last consistent read_adc(), per channel.
+  uint16_t m_last_adc[4] = {};
+  /// Channels m_last_adc holds a consistent value of, as adc_channels bits.
+  unsigned m_adc_valid = 0;
+
 public:
+  /// SW6106 answers on a fixed address, it can't be changed.
+  static constexpr byte i2c_address = 0x3c;
+
+  /// Value of the chip version register of a genuine SW6106.
+  static constexpr unsigned expected_chip_version = 6;
+
   sw6106(i2c::controller::ptr controller);
 
   /**
@@ -59,7 +76,7 @@ public:
 
     CATEGORY_0_INTERRUPTS =
         SHORT_CIRCUIT | IC_OVER_TEMPERATURE | BATTERY_OVER_TEMPERATURE |
-        BATTERY_OVER_TEMPERATURE | CHARGE_TIMEOUT | MICRO_USB_OVERVOLTAGE |
+        BATTERY_VOLTAGE_TOO_LOW | CHARGE_TIMEOUT | MICRO_USB_OVERVOLTAGE |
         TYPE_C_OVERVOLTAGE | BATTERY_VOLTAGE_TOO_HIGH,
 
     CATEGORY_1_INTERRUPTS = PORT_A_CONNECTED | PORT_A_DISCONNECTED |
@@ -87,11 +104,124 @@ public:
    */
   void enable_interrupts(const interrupts &i);
 
+  /**
+   * Pending interrupts together with the time they were signalled.
+   * All timestamps are CLOCK_MONOTONIC.
+   */
+  struct interrupt_event {
+    interrupts flags = interrupts::NONE;
+    /// When the interrupt was raised: the kernel timestamp of the GPIO edge,
+    /// or the time of the read if the device is polled.
+    std::chrono::nanoseconds timestamp{0};
+    /// When the interrupt registers were read and cleared.
+    std::chrono::nanoseconds handled{0};
+
+    std::chrono::nanoseconds latency() const { return handled - timestamp; }
+  };
+
   /**
    * Read and clear any pending interrupts.
    */
   interrupts read_interrupts();
 
+  /**
+   * Read and clear any pending interrupts, attributing them to an edge.
+   * @param edge_timestamp CLOCK_MONOTONIC time of the interrupt line edge, or
+   * zero if unknown.
+   */
+  interrupt_event read_interrupts(std::chrono::nanoseconds edge_timestamp);
+
+  /**
+   * All of the device measurements, read in one go.
+   */
+  struct snapshot {
+    system_status status = system_status::NONE;
+    unsigned charge_percent = 0;
+    unsigned battery_voltage_mv = 0;
+    unsigned output_voltage_mv = 0;
+    unsigned charge_current_ma = 0;
+    unsigned discharge_current_ma = 0;
+
+    bool operator==(const snapshot &) const = default;
+  };
+
+  /**
+   * Read status and every ADC channel, the latter with read_adc().
+   * @note Battery voltage and currents read as 0 in idle state, same as
+   * their individual getters.
+   */
+  snapshot get_snapshot();
+
+  /**
+   * Raw output side ADC registers. Reading them is all a high rate capture
+   * can afford per sample, decoding is left for later.
+   */
+  struct output_adc {
+    byte vbat_vout_high = 0;    // 0x15, Vout in [7:4]
+    byte vout_low = 0;          // 0x16
+    byte ichg_idischg_high = 0; // 0x18, IDischarge in [7:4]
+    byte idischg_low = 0;       // 0x19
+
+    unsigned output_voltage_mv() const;
+    unsigned discharge_current_ma() const;
+  };
+
+  /**
+   * Read output voltage and discharge current registers, undecoded.
+   */
+  output_adc read_output_adc();
+
+  /**
+   * ADC channels, for read_adc().
+   */
+  enum class adc_channels : unsigned {
+    NONE = 0,
+    BATTERY_VOLTAGE = 1,
+    OUTPUT_VOLTAGE = (1 << 1),
+    CHARGE_CURRENT = (1 << 2),
+    DISCHARGE_CURRENT = (1 << 3),
+    ALL = BATTERY_VOLTAGE | OUTPUT_VOLTAGE | CHARGE_CURRENT | DISCHARGE_CURRENT
+  };
+
+  /// Rereads allowed per register pair before read_adc() gives up.
+  static constexpr unsigned adc_retry_budget = 3;
+
+  /**
+   * ADC channels read by read_adc(). Channels not asked for read as 0.
+   */
+  struct adc_reading {
+    unsigned battery_voltage_mv = 0;
+    unsigned output_voltage_mv = 0;
+    unsigned charge_current_ma = 0;
+    unsigned discharge_current_ma = 0;
+
+    /// Tears detected, each cost a reread.
+    unsigned tears = 0;
+    /// Register reads it took.
+    unsigned reads = 0;
+    /// False if the retry budget ran out. The channels that couldn't be
+    /// read whole hold their previous consistent value then, or the last
+    /// attempt if there is none.
+    bool consistent = true;
+  };
+
+  /**
+   * Read ADC channels without tearing them.
+   *
+   * Each channel is 12 bits, split over a low register of its own and half
+   * of a high register shared with another channel: 0x15 holds the upper
+   * bits of battery and output voltage, 0x18 those of both currents. The chip
+   * may convert between two reads, so the high register is read before and
+   * after the low ones. If it reads the same both times, the low registers
+   * belong with it. Otherwise the second read starts the next attempt, up to
+   * \ref adc_retry_budget of them.
+   *
+   * This takes as many reads as the individual getters for every channel,
+   * which read each high register twice anyway.
+   * @param channels bitwise or of \ref adc_channels.
+   */
+  adc_reading read_adc(adc_channels channels = adc_channels::ALL);
+
   /**
    * Read system status. Refer to \ref system_status for more details.
    * @return system_status struct.
@@ -135,7 +265,19 @@ public:
    * @return Discharge current in milliampers.
    */
   unsigned get_discharge_current_ma();
+
+private:
+  struct adc_pair;
+  bool read_adc_pair(const adc_pair &pair, unsigned channels,
+                     adc_reading &reading);
 };
 
+// These and the descriptions are in sw6106_text.cpp, built into the daemon
+// rather than the library.
+text::writer &operator<<(text::writer &out, const sw6106::system_status &s);
+text::writer &operator<<(text::writer &out, const sw6106::interrupts &i);
+
+#if !SW6106_LEAN
 std::ostream &operator<<(std::ostream &out, const sw6106::system_status &s);
 std::ostream &operator<<(std::ostream &out, const sw6106::interrupts &i);
+#endif
@@ -0,0 +1,108 @@
+#include "sw6106.h"
+
+// Descriptions and printing of the flags, the daemon's rather than the
+// library's.
+
+// Streams straight into the output, no temporary strings.
+template <class Out, class E>
+void print_bitflags(Out &out, const E val,
+                    const std::map<E, std::string> &descriptions) {
+  bool first = true;
+  for (const auto &desc : descriptions) {
+    // Very much type safe, as safe as it could possibly get.
+    if (static_cast<std::underlying_type<E>::type>(val) &
+        static_cast<std::underlying_type<E>::type>(desc.first)) {
+      if (!first)
+        out << '\n';
+      out << '\t' << desc.second;
+      first = false;
+    }
+  }
+}
+
+const std::map<sw6106::system_status, std::string>
+    sw6106::system_status_descriptions{
+        {sw6106::system_status::PORT_A_CONNECTED,
+         "USB type A port is connected"},
+        {sw6106::system_status::PORT_MICRO_CONNECTED,
+         "Micro USB port is connected"},
+        {sw6106::system_status::PORT_C_CONNECTED,
+         "USB type C port is connected"},
+        {sw6106::system_status::CHARGER_CONNECTED, "Charger is connected"},
+        {sw6106::system_status::BOOST_CONVERTER_ENABLED,
+         "Boost converter is enabled"},
+    };
+
+const std::map<sw6106::interrupts, std::string> sw6106::interrupts_descriptions{
+    {sw6106::interrupts::SHORT_CIRCUIT, "Short circuit protection triggered"},
+    {sw6106::interrupts::IC_OVER_TEMPERATURE,
+     "Integrated circuit overtemperature protection triggered"},
+    {sw6106::interrupts::BATTERY_OVER_TEMPERATURE,
+     "Battery overtemperature protection triggered"},
+    {sw6106::interrupts::BATTERY_VOLTAGE_TOO_LOW, "Battery voltage is too low"},
+    {sw6106::interrupts::CHARGE_TIMEOUT, "Battery charging is taking too long"},
+    {sw6106::interrupts::MICRO_USB_OVERVOLTAGE,
+     "Voltage on Micro USB port is too high"},
+    {sw6106::interrupts::TYPE_C_OVERVOLTAGE,
+     "Voltage on Type C port is too high"},
+    {sw6106::interrupts::BATTERY_VOLTAGE_TOO_HIGH,
+     "Battery voltage is too high"},
+    {sw6106::interrupts::PORT_A_CONNECTED, "USB type A port is connected"},
+    {sw6106::interrupts::PORT_A_DISCONNECTED,
+     "USB type A port is disconnected"},
+    {sw6106::interrupts::PORT_MICRO_CONNECTED, "Micro USB port is connected"},
+    {sw6106::interrupts::PORT_MICRO_DISCONNECTED,
+     "Micro USB port is disconnected"},
+    {sw6106::interrupts::PORT_C_CONNECTED, "USB type C port is connected"},
+    {sw6106::interrupts::PORT_C_DISCONNECTED,
+     "USB type C port is disconnected"},
+    {sw6106::interrupts::SHORT_CONTROL_KEY_PRESS,
+     "Control key has been pressed shortly"},
+    {sw6106::interrupts::FAST_CHARGE_STATUS_CHANGED,
+     "Fast charge status changed"},
+    {sw6106::interrupts::CHARGE_PERCENT_CHANGED, "Charge percent changed"},
+    {sw6106::interrupts::BOOST_CONVERTER_DISABLED, "Boost converter disabled"},
+    {sw6106::interrupts::BOOST_CONVERTER_ENABLED, "Boost converter enabled"},
+    {sw6106::interrupts::CHARGER_DISABLED, "Charging disabled"},
+    {sw6106::interrupts::CHARGER_ENABLED, "Charging enabled"},
+    {sw6106::interrupts::CHARGE_BELLOW_5_PERCENT,
+     "Charge level is bellow 5 percent"},
+    {sw6106::interrupts::FULLY_CHARGED, "Battery is fully charged"},
+    {sw6106::interrupts::WLED_STATE_CHANGED, "WLED state changed"},
+};
+
+template <class Out>
+static void print_status(Out &out, const sw6106::system_status &s) {
+  if (s == sw6106::system_status::NONE)
+    out << "\tIdle";
+  else
+    print_bitflags(out, s, sw6106::system_status_descriptions);
+}
+
+template <class Out>
+static void print_interrupts(Out &out, const sw6106::interrupts &i) {
+  if (i != sw6106::interrupts::NONE)
+    print_bitflags(out, i, sw6106::interrupts_descriptions);
+}
+
+text::writer &operator<<(text::writer &out, const sw6106::system_status &s) {
+  print_status(out, s);
+  return out;
+}
+
+text::writer &operator<<(text::writer &out, const sw6106::interrupts &i) {
+  print_interrupts(out, i);
+  return out;
+}
+
+#if !SW6106_LEAN
+std::ostream &operator<<(std::ostream &out, const sw6106::system_status &s) {
+  print_status(out, s);
+  return out;
+}
+
+std::ostream &operator<<(std::ostream &out, const sw6106::interrupts &i) {
+  print_interrupts(out, i);
+  return out;
+}
+#endif
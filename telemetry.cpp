@@ -0,0 +1,478 @@
+#include "telemetry.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace telemetry {
+
+static const bytes::byte magic[] = {'S', 'W', '6', 'T'};
+static const bytes::byte version = 2;
+// Blocks without length and checksum, from before version 2. Still read.
+static const bytes::byte unframed_version = 1;
+static const bytes::byte block_tag = 0x01;
+// Tag, u32 length in front of the block, u32 CRC-32 after it.
+static const size_t frame_size = 1 + 4 + 4;
+
+// Stored as deltas, in this order.
+static constexpr unsigned sw6106::snapshot::*channels[] = {
+    &sw6106::snapshot::charge_percent,
+    &sw6106::snapshot::battery_voltage_mv,
+    &sw6106::snapshot::output_voltage_mv,
+    &sw6106::snapshot::charge_current_ma,
+    &sw6106::snapshot::discharge_current_ma,
+};
+
+// Largest value each channel can take, anything above is a decoding error.
+static const int64_t channel_max[] = {100, 0xffff, 0xffff, 0xffff, 0xffff};
+
+// A corrupted count must not make the decoder allocate gigabytes.
+static const uint64_t max_block_records = 65536;
+
+// Worst case of a block: every varint at its longest.
+static size_t max_block_size(size_t records) {
+  return sizeof(magic) + 1 + frame_size + 10 +
+         records * (10 + 1 + 10 + 5 * 10);
+}
+
+static constexpr auto crc_table = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < table.size(); ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit)
+      crc = crc & 1 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+    table[i] = crc;
+  }
+  return table;
+}();
+
+// CRC-32 as in zlib.
+static uint32_t crc32(const bytes::byte *data, size_t size) {
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; ++i)
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+encoder::encoder(size_t block_records) : m_block_records(block_records) {
+  if (block_records < 1 || block_records > max_block_records)
+    throw std::invalid_argument("Block size should be between 1 and " +
+                                std::to_string(max_block_records) + " records");
+
+  m_block.reserve(block_records);
+  m_output.reserve(max_block_size(block_records));
+}
+
+bool encoder::push(const record &r) {
+  m_block.push_back(r);
+
+  if (m_block.size() < m_block_records)
+    return false;
+
+  encode_block();
+  return true;
+}
+
+void encoder::finish() {
+  if (!m_block.empty())
+    encode_block();
+}
+
+void encoder::encode_block() {
+  if (!m_header_written) {
+    m_output.insert(m_output.end(), std::begin(magic), std::end(magic));
+    m_output.push_back(version);
+    m_header_written = true;
+  }
+
+  // Within the capacity reserved upfront, like everything else here.
+  const size_t frame = m_output.size();
+  m_output.resize(frame + 1 + 4);
+  m_output[frame] = block_tag;
+  const size_t payload = m_output.size();
+
+  bytes::put_varint(m_output, m_block.size());
+
+  for (const record &r : m_block) {
+    const int64_t delta = r.timestamp_ms - m_timestamp;
+    bytes::put_varint(m_output, bytes::zigzag(delta - m_delta));
+    m_timestamp = r.timestamp_ms;
+    m_delta = delta;
+  }
+
+  size_t runs = 1;
+  for (size_t i = 1; i < m_block.size(); ++i)
+    runs += m_block[i].data.status != m_block[i - 1].data.status;
+
+  bytes::put_varint(m_output, runs);
+  for (size_t i = 0; i < m_block.size();) {
+    size_t length = 1;
+    while (i + length < m_block.size() &&
+           m_block[i + length].data.status == m_block[i].data.status)
+      ++length;
+
+    m_output.push_back(static_cast<bytes::byte>(m_block[i].data.status));
+    bytes::put_varint(m_output, length);
+    i += length;
+  }
+
+  for (size_t c = 0; c < std::size(channels); ++c)
+    for (const record &r : m_block) {
+      const int64_t value = r.data.*channels[c];
+      bytes::put_varint(m_output, bytes::zigzag(value - m_channels[c]));
+      m_channels[c] = value;
+    }
+
+  bytes::write_le<uint32_t>(&m_output[frame + 1],
+                            static_cast<uint32_t>(m_output.size() - payload));
+  const uint32_t crc = crc32(&m_output[frame], m_output.size() - frame);
+  m_output.resize(m_output.size() + 4);
+  bytes::write_le<uint32_t>(&m_output[m_output.size() - 4], crc);
+
+  m_block.clear();
+}
+
+decoder::decoder(const bytes::vect &data) : m_data(data) {}
+
+bool decoder::read_varint(uint64_t &val) {
+  const size_t used = bytes::get_varint(m_data.data() + m_position,
+                                        m_end - m_position, val);
+  m_position += used;
+  return used > 0;
+}
+
+bool decoder::decode_block() {
+  m_end = m_data.size();
+  if (m_position == m_data.size())
+    return false;
+
+  if (m_data[m_position] == magic[0]) {
+    if (m_data.size() - m_position < sizeof(magic) + 1 ||
+        std::memcmp(&m_data[m_position], magic, sizeof(magic)) != 0)
+      return false;
+
+    const bytes::byte session_version = m_data[m_position + sizeof(magic)];
+    if (session_version != version && session_version != unframed_version)
+      return false;
+
+    m_version = session_version;
+    m_position += sizeof(magic) + 1;
+    m_timestamp = 0;
+    m_delta = 0;
+    m_channels = {};
+  }
+
+  const size_t frame = m_position;
+  if (m_version == 0 || m_position == m_data.size() ||
+      m_data[m_position++] != block_tag)
+    return false;
+
+  // The whole block is checked before anything in it is decoded, a torn one
+  // mustn't run on into the session after it.
+  if (m_version == version) {
+    if (m_data.size() - m_position < 4)
+      return false;
+
+    const uint32_t length = bytes::read_le<uint32_t>(&m_data[m_position]);
+    m_position += 4;
+    if (length > m_data.size() - m_position ||
+        m_data.size() - m_position - length < 4)
+      return false;
+
+    m_end = m_position + length;
+    if (crc32(&m_data[frame], m_end - frame) !=
+        bytes::read_le<uint32_t>(&m_data[m_end]))
+      return false;
+  }
+
+  uint64_t count;
+  if (!read_varint(count) || count == 0 || count > max_block_records)
+    return false;
+
+  m_block.resize(count);
+  m_next = 0;
+
+  for (record &r : m_block) {
+    uint64_t dod;
+    if (!read_varint(dod))
+      return false;
+
+    m_delta += bytes::unzigzag(dod);
+    m_timestamp += m_delta;
+    r.timestamp_ms = m_timestamp;
+  }
+
+  uint64_t runs;
+  if (!read_varint(runs))
+    return false;
+
+  size_t filled = 0;
+  for (uint64_t run = 0; run < runs; ++run) {
+    uint64_t length;
+    if (m_position >= m_end)
+      return false;
+
+    const auto status =
+        static_cast<sw6106::system_status>(m_data[m_position++]);
+    if (!read_varint(length) || length > count - filled)
+      return false;
+
+    for (uint64_t i = 0; i < length; ++i)
+      m_block[filled++].data.status = status;
+  }
+
+  if (filled != count)
+    return false;
+
+  for (size_t c = 0; c < std::size(channels); ++c)
+    for (record &r : m_block) {
+      uint64_t delta;
+      if (!read_varint(delta))
+        return false;
+
+      m_channels[c] += bytes::unzigzag(delta);
+      if (m_channels[c] < 0 || m_channels[c] > channel_max[c])
+        return false;
+
+      r.data.*channels[c] = static_cast<unsigned>(m_channels[c]);
+    }
+
+  for (const record &r : m_block)
+    if (r.timestamp_ms <= 0)
+      return false;
+
+  if (m_version == version) {
+    if (m_position != m_end)
+      return false;
+    m_position = m_end + 4;
+  }
+
+  return true;
+}
+
+bool decoder::next(record &r) {
+  while (m_next == m_block.size()) {
+    const size_t block_start = m_position;
+
+    if (m_position == m_data.size())
+      return false;
+
+    if (decode_block())
+      break;
+
+    // Most likely a block cut short by a power loss. The daemon started a new
+    // session after that, pick it up from its header. The blocks of a session
+    // build on each other, so the rest of this one is lost either way.
+    m_damaged = true;
+    m_block.clear();
+    m_next = 0;
+
+    const auto header = std::search(m_data.begin() + block_start + 1,
+                                    m_data.end(), std::begin(magic),
+                                    std::end(magic));
+    m_position = header - m_data.begin();
+  }
+
+  r = m_block[m_next++];
+  return true;
+}
+
+archive_writer::archive_writer(const std::filesystem::path &path,
+                               size_t block_records)
+    : m_encoder(block_records) {
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_fd < 0)
+    throw std::runtime_error("Failed to open telemetry archive " +
+                             path.generic_string() + ": " + strerror(errno));
+}
+
+archive_writer::~archive_writer() {
+  m_encoder.finish();
+  write_output();
+  ::close(m_fd);
+}
+
+void archive_writer::append(const record &r) {
+  if (m_encoder.push(r))
+    write_output();
+}
+
+void archive_writer::write_output() {
+  const bytes::vect &data = m_encoder.output();
+
+  // One write per block, so the file only ever ends in a partial block if
+  // the power went away in the middle of it.
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t res = ::write(m_fd, data.data() + done, data.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0) {
+      text::err() << "Failed to write telemetry archive: " << strerror(errno)
+                  << text::endl;
+      break;
+    }
+    done += res;
+  }
+
+  m_encoder.clear_output();
+}
+
+static bytes::vect read_archive(const std::filesystem::path &path) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open " + path.generic_string() + ": " +
+                             strerror(errno));
+
+  struct stat st {};
+  fstat(fd, &st);
+
+  bytes::vect data(st.st_size);
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t res = ::read(fd, data.data() + done, data.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    done += res;
+  }
+
+  ::close(fd);
+  data.resize(done);
+  return data;
+}
+
+codec_result export_csv(const std::filesystem::path &path, text::writer &out) {
+  const bytes::vect data = read_archive(path);
+
+  codec_result result;
+  result.encoded_bytes = data.size();
+
+  out << "time_ms,status,charge_percent,battery_voltage_mv,output_voltage_mv,"
+         "charge_current_ma,discharge_current_ma\n";
+
+  decoder decode(data);
+  record r;
+  uint64_t decode_ns = 0;
+  uint64_t start = stats::now_ns();
+
+  while (decode.next(r)) {
+    decode_ns += stats::now_ns() - start;
+    ++result.records;
+
+    out << r.timestamp_ms << ',' << static_cast<unsigned>(r.data.status) << ','
+        << r.data.charge_percent << ',' << r.data.battery_voltage_mv << ','
+        << r.data.output_voltage_mv << ',' << r.data.charge_current_ma << ','
+        << r.data.discharge_current_ma << '\n';
+
+    start = stats::now_ns();
+  }
+
+  out.flush();
+
+  result.decode_ns = decode_ns;
+  result.damaged = decode.damaged();
+  return result;
+}
+
+codec_result benchmark(size_t records, size_t block_records) {
+  // Discharge at a steady load with some noise, timing jitter and the
+  // occasional status change. Deterministic, so runs are comparable.
+  uint32_t seed = 1;
+  auto noise = [&seed](int range) {
+    seed = seed * 1664525 + 1013904223;
+    return static_cast<int>((seed >> 16) % (2 * range + 1)) - range;
+  };
+
+  std::vector<record> input(records);
+  int64_t time = 1700000000000;
+  for (size_t i = 0; i < records; ++i) {
+    record &r = input[i];
+    time += 1000 + (i % 17 == 0 ? noise(3) : 0);
+    r.timestamp_ms = time;
+    r.data.status = (i / 3600) % 8 == 7
+                        ? sw6106::system_status::CHARGER_CONNECTED
+                        : sw6106::system_status::BOOST_CONVERTER_ENABLED;
+    r.data.charge_percent = 100 - i * 100 / records;
+    r.data.battery_voltage_mv = 4200 - i * 1000 / records + noise(4);
+    r.data.output_voltage_mv = 5100 + noise(20);
+    r.data.discharge_current_ma = 450 + noise(60);
+  }
+
+  codec_result result;
+  result.records = records;
+
+  bytes::vect archive;
+  archive.reserve(max_block_size(records));
+
+  encoder encode(block_records);
+  uint64_t start = stats::now_ns();
+  for (const record &r : input)
+    if (encode.push(r)) {
+      archive.insert(archive.end(), encode.output().begin(),
+                     encode.output().end());
+      encode.clear_output();
+    }
+  encode.finish();
+  archive.insert(archive.end(), encode.output().begin(), encode.output().end());
+  result.encode_ns = stats::now_ns() - start;
+  result.encoded_bytes = archive.size();
+
+  decoder decode(archive);
+  record r;
+  size_t decoded = 0;
+  start = stats::now_ns();
+  while (decode.next(r)) {
+    if (!(r == input[decoded]))
+      throw std::runtime_error("Telemetry codec round trip mismatch at record " +
+                               std::to_string(decoded));
+    ++decoded;
+  }
+  result.decode_ns = stats::now_ns() - start;
+
+  if (decoded != records)
+    throw std::runtime_error("Telemetry codec decoded " +
+                             std::to_string(decoded) + " records out of " +
+                             std::to_string(records));
+
+  return result;
+}
+
+// MB/s of records in their raw form, the figure that matters when exporting.
+static uint64_t throughput_mbps(size_t records, uint64_t ns) {
+  return ns ? records * raw_record_size * 1000 / ns : 0;
+}
+
+text::writer &operator<<(text::writer &out, const codec_result &r) {
+  const size_t raw = r.records * raw_record_size;
+
+  out << r.records << " records, " << r.encoded_bytes << " bytes encoded, "
+      << raw << " bytes raw";
+
+  if (r.encoded_bytes > 0) {
+    const size_t ratio_x100 = raw * 100 / r.encoded_bytes;
+    out << ", ratio " << ratio_x100 / 100 << '.' << ratio_x100 / 10 % 10
+        << ratio_x100 % 10 << ":1";
+  }
+
+  if (r.encode_ns > 0)
+    out << "\nEncode: " << r.encode_ns / 1000 << " us, "
+        << throughput_mbps(r.records, r.encode_ns) << " MB/s";
+
+  if (r.decode_ns > 0)
+    out << "\nDecode: " << r.decode_ns / 1000 << " us, "
+        << throughput_mbps(r.records, r.decode_ns) << " MB/s";
+
+  if (r.damaged)
+    out << "\nDamaged blocks were skipped";
+
+  return out;
+}
+
+} // namespace telemetry
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "byte_util.h"
+#include "sw6106.h"
+#include "text.h"
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Compact archive of sw6106 telemetry, for keeping long histories on flash.
+//
+// An archive is one or more sessions, each starting with "SW6T" and a version
+// byte, so a restarted daemon simply appends a new one. A session is a run of
+// blocks: a tag byte, the u32 length of the block, the block and a u32
+// CRC-32 of all three before it, little endian. Records are stored by column
+// within a block:
+// - timestamps as zig-zag varints of the delta of deltas, a steady sampling
+//   rate costs one byte per record
+// - system status as run lengths
+// - every ADC channel as zig-zag varints of the delta to the previous record
+// Blocks are written whole. A block cut short by a power loss, or one that
+// fails its checksum or decodes to values out of range, is skipped on
+// decoding along with the rest of its session, up to the next session.
+// Version 1 sessions, without length and checksum, are still read.
+
+namespace telemetry {
+
+struct record {
+  int64_t timestamp_ms = 0; // Unix time
+  sw6106::snapshot data;
+
+  bool operator==(const record &) const = default;
+};
+
+/// Size of a record stored as plain fixed width fields, the reference for
+/// compression ratios.
+static constexpr size_t raw_record_size = 8 + 1 + 1 + 4 * 2;
+
+class encoder {
+  size_t m_block_records;
+  std::vector<record> m_block;
+  bytes::vect m_output;
+  bool m_header_written = false;
+
+  int64_t m_timestamp = 0;
+  int64_t m_delta = 0;
+  std::array<int64_t, 5> m_channels{};
+
+  void encode_block();
+
+public:
+  /**
+   * Both the pending block and the output are allocated here, pushing
+   * records doesn't allocate.
+   * @param block_records records per block. Bigger blocks compress better,
+   * but more records are lost when the process dies.
+   */
+  explicit encoder(size_t block_records = 64);
+
+  /**
+   * Add a record.
+   * @return true if a block was completed, and output() should be written
+   * out.
+   */
+  bool push(const record &r);
+
+  /// Encode the records pending in an incomplete block.
+  void finish();
+
+  const bytes::vect &output() const { return m_output; }
+  void clear_output() { m_output.clear(); }
+};
+
+class decoder {
+  const bytes::vect &m_data;
+  size_t m_position = 0;
+
+  std::vector<record> m_block;
+  size_t m_next = 0;
+  bool m_damaged = false;
+
+  bytes::byte m_version = 0; // of the current session, 0 before the first
+  size_t m_end = 0;          // of the block being decoded
+
+  int64_t m_timestamp = 0;
+  int64_t m_delta = 0;
+  std::array<int64_t, 5> m_channels{};
+
+  bool read_varint(uint64_t &val);
+  bool decode_block();
+
+public:
+  explicit decoder(const bytes::vect &data);
+
+  /**
+   * Get the next record.
+   * @return false once the archive is exhausted.
+   */
+  bool next(record &r);
+
+  /// True if damaged or incomplete blocks were skipped.
+  bool damaged() const { return m_damaged; }
+};
+
+/**
+ * Appends records to an archive file, a block at a time.
+ */
+class archive_writer {
+  int m_fd = -1;
+  encoder m_encoder;
+
+  void write_output();
+
+public:
+  archive_writer(const std::filesystem::path &path, size_t block_records);
+  ~archive_writer();
+
+  archive_writer(const archive_writer &) = delete;
+  archive_writer &operator=(const archive_writer &) = delete;
+
+  void append(const record &r);
+};
+
+struct codec_result {
+  size_t records = 0;
+  size_t encoded_bytes = 0;
+  uint64_t encode_ns = 0;
+  uint64_t decode_ns = 0;
+  bool damaged = false;
+};
+
+text::writer &operator<<(text::writer &out, const codec_result &r);
+
+/**
+ * Decode an archive file and print it as CSV.
+ */
+codec_result export_csv(const std::filesystem::path &path, text::writer &out);
+
+/**
+ * Round trip a day worth of synthetic 1 Hz telemetry through the codec.
+ */
+codec_result benchmark(size_t records = 86400, size_t block_records = 64);
+
+} // namespace telemetry
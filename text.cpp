@@ -0,0 +1,89 @@
+#include "text.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifndef SW6106_LEAN
+#define SW6106_LEAN 0
+#endif
+
+#if !SW6106_LEAN
+#include <iostream>
+#endif
+
+namespace text {
+
+writer::writer(int fd) : m_fd(fd) {}
+
+writer::~writer() { flush(); }
+
+void writer::append(const char *data, size_t size) {
+  while (size > 0) {
+    if (m_size == sizeof(m_buffer))
+      flush();
+
+    const size_t chunk = std::min(size, sizeof(m_buffer) - m_size);
+    std::memcpy(m_buffer + m_size, data, chunk);
+    m_size += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+void writer::flush() {
+  if (m_size == 0)
+    return;
+
+#if !SW6106_LEAN
+  if (m_fd == STDOUT_FILENO || m_fd == STDERR_FILENO) {
+    std::ostream &stream = m_fd == STDERR_FILENO ? std::cerr : std::cout;
+    stream.write(m_buffer, m_size).flush();
+    m_size = 0;
+    return;
+  }
+#endif
+
+  size_t done = 0;
+  while (done < m_size) {
+    ssize_t res = ::write(m_fd, m_buffer + done, m_size - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    done += res;
+  }
+
+  m_size = 0;
+}
+
+writer &writer::operator<<(std::string_view str) {
+  append(str.data(), str.size());
+  return *this;
+}
+
+writer &writer::operator<<(char c) {
+  append(&c, 1);
+  return *this;
+}
+
+writer &operator<<(writer &out, endl_t) {
+  out << '\n';
+  out.flush();
+  return out;
+}
+
+// One per thread: the reporter and the acquisition both log, and a buffer
+// must never be shared between them.
+writer &out() {
+  static thread_local writer instance(STDOUT_FILENO);
+  return instance;
+}
+
+writer &err() {
+  static thread_local writer instance(STDERR_FILENO);
+  return instance;
+}
+
+} // namespace text
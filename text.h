@@ -0,0 +1,73 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Minimal text output used throughout the daemon instead of iostreams.
+// Output goes straight to write(2). In full builds stdout and stderr are the
+// exception: they are forwarded to std::cout/std::cerr, so they mix well with
+// other stream users.
+
+namespace text {
+
+class writer {
+  int m_fd;
+  char m_buffer[1024];
+  size_t m_size = 0;
+
+  void append(const char *data, size_t size);
+
+public:
+  explicit writer(int fd);
+  ~writer();
+
+  writer(const writer &) = delete;
+  writer &operator=(const writer &) = delete;
+
+  void flush();
+
+  writer &operator<<(std::string_view str);
+  writer &operator<<(const char *str) { return *this << std::string_view(str); }
+  writer &operator<<(const std::string &str) {
+    return *this << std::string_view(str);
+  }
+  writer &operator<<(char c);
+
+  template <std::integral T>
+    requires(!std::same_as<T, char> && !std::same_as<T, bool>)
+  writer &operator<<(T value) {
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    const bool negative = value < 0;
+
+    // Work on the magnitude as unsigned, so the minimum value doesn't overflow.
+    unsigned long long magnitude =
+        negative ? 0ULL - static_cast<unsigned long long>(value)
+                 : static_cast<unsigned long long>(value);
+    do {
+      *--p = '0' + magnitude % 10;
+      magnitude /= 10;
+    } while (magnitude);
+
+    if (negative)
+      *--p = '-';
+
+    append(p, digits + sizeof(digits) - p);
+    return *this;
+  }
+};
+
+/// Newline and flush, the std::endl of this module.
+struct endl_t {};
+inline constexpr endl_t endl{};
+
+writer &operator<<(writer &out, endl_t);
+
+/// Writers of the calling thread, lines from different threads don't mix as
+/// long as each ends with endl.
+writer &out(); // stdout
+writer &err(); // stderr
+
+} // namespace text
@@ -0,0 +1,397 @@
+#include "trace.h"
+#include "stats.h"
+#include "text.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/i2c.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace trace {
+
+using bytes::byte;
+
+static const byte magic[] = {'S', 'W', '6', 'R'};
+static const size_t header_size = 16;
+
+static const uint16_t flag_gpio = 1;
+
+static const byte tag_gpio = 0x01;
+static const byte tag_write = 0x02;
+static const byte tag_read = 0x04;
+static const byte tag_failed = 0x08;
+
+static const size_t buffer_capacity = 8192;
+static const size_t flush_size = 4096;
+static const uint64_t flush_interval_ns = 1000000000;
+
+// Largest entry worth buffering, anything longer is cut short.
+static const size_t max_message = 512;
+static const size_t max_entry = 4 + 3 * 10 + 2 * max_message;
+
+// Writer
+
+writer::writer(const fs::path &path, bool gpio)
+    : m_last_ns(stats::now_ns()), m_flushed_ns(m_last_ns) {
+  m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (m_fd < 0)
+    throw std::runtime_error("Failed to create trace " +
+                             path.generic_string() + ": " + strerror(errno));
+
+  m_buffer.reserve(buffer_capacity);
+  m_buffer.resize(header_size);
+
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  std::memcpy(m_buffer.data(), magic, sizeof(magic));
+  bytes::write_le(m_buffer.data() + 4, version);
+  bytes::write_le(m_buffer.data() + 6, gpio ? flag_gpio : uint16_t(0));
+  bytes::write_le(m_buffer.data() + 8,
+                  static_cast<uint64_t>(now.tv_sec) * 1000000000ULL +
+                      now.tv_nsec);
+  flush();
+}
+
+writer::~writer() {
+  if (m_fd < 0)
+    return;
+
+  flush();
+  ::close(m_fd);
+}
+
+void writer::flush() {
+  size_t done = 0;
+  while (m_fd >= 0 && done < m_buffer.size()) {
+    ssize_t res = ::write(m_fd, m_buffer.data() + done, m_buffer.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0) {
+      text::err() << "Failed to write trace, recording stopped: "
+                  << strerror(errno) << text::endl;
+      ::close(m_fd);
+      m_fd = -1;
+      break;
+    }
+    done += res;
+  }
+
+  m_buffer.clear();
+  m_flushed_ns = m_last_ns;
+}
+
+void writer::begin(byte tag) {
+  const uint64_t now = stats::now_ns();
+  if (m_buffer.size() + max_entry > buffer_capacity)
+    flush();
+
+  m_buffer.push_back(tag);
+  bytes::put_varint(m_buffer, (now - m_last_ns) / 1000);
+
+  // Only whole microseconds are recorded, keep the rest for the next entry
+  // so the error doesn't add up.
+  m_last_ns = now - (now - m_last_ns) % 1000;
+  ++m_entries;
+}
+
+void writer::transaction(const i2c_msg *messages, unsigned count, int error) {
+  if (m_fd < 0)
+    return;
+
+  // The controller only ever sends a write, a read, or a write followed by
+  // a read.
+  const i2c_msg *write = nullptr;
+  const i2c_msg *read = nullptr;
+  for (unsigned i = 0; i < count && i < 2; ++i) {
+    if (messages[i].flags & I2C_M_RD)
+      read = &messages[i];
+    else if (!read)
+      write = &messages[i];
+  }
+
+  byte tag = 0;
+  if (write)
+    tag |= tag_write;
+  if (read)
+    tag |= tag_read;
+  if (error)
+    tag |= tag_failed;
+
+  begin(tag);
+  m_buffer.push_back(messages[0].addr);
+
+  if (write) {
+    const size_t len = std::min<size_t>(write->len, max_message);
+    bytes::put_varint(m_buffer, len);
+    m_buffer.insert(m_buffer.end(), write->buf, write->buf + len);
+  }
+
+  if (read) {
+    const size_t len = std::min<size_t>(read->len, max_message);
+    bytes::put_varint(m_buffer, len);
+    if (!error)
+      m_buffer.insert(m_buffer.end(), read->buf, read->buf + len);
+  }
+
+  if (error)
+    bytes::put_varint(m_buffer, error);
+
+  if (m_buffer.size() >= flush_size ||
+      m_last_ns - m_flushed_ns >= flush_interval_ns)
+    flush();
+}
+
+void writer::gpio(uint32_t value) {
+  if (m_fd < 0)
+    return;
+
+  begin(tag_gpio);
+  bytes::put_varint(m_buffer, value);
+
+  if (m_buffer.size() >= flush_size ||
+      m_last_ns - m_flushed_ns >= flush_interval_ns)
+    flush();
+}
+
+// Replay
+
+/**
+ * Size of the entry data starts with, 0 if it's cut short or makes no sense.
+ */
+static size_t entry_size(const byte *data, size_t size) {
+  size_t at = 1;
+  uint64_t value = 0;
+  auto varint = [&] {
+    const size_t used = bytes::get_varint(data + at, size - at, value);
+    at += used;
+    return used != 0;
+  };
+
+  if (size == 0 || !varint())
+    return 0;
+
+  const byte tag = data[0];
+  if (tag == tag_gpio)
+    return varint() ? at : 0;
+
+  if ((tag & tag_gpio) || at == size)
+    return 0;
+  ++at; // address
+
+  if (tag & tag_write) {
+    if (!varint() || value > size - at)
+      return 0;
+    at += value;
+  }
+
+  if (tag & tag_read) {
+    if (!varint())
+      return 0;
+    if (!(tag & tag_failed)) {
+      if (value > size - at)
+        return 0;
+      at += value;
+    }
+  }
+
+  if ((tag & tag_failed) && !varint())
+    return 0;
+
+  return at;
+}
+
+replay::replay(const fs::path &path, unsigned speed)
+    : m_offset(header_size), m_speed(speed) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open trace " + path.generic_string() +
+                             ": " + strerror(errno));
+
+  struct stat st {};
+  fstat(fd, &st);
+  m_trace.resize(st.st_size);
+
+  size_t done = 0;
+  while (done < m_trace.size()) {
+    const ssize_t res = ::read(fd, m_trace.data() + done, m_trace.size() - done);
+    if (res < 0 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    done += res;
+  }
+  ::close(fd);
+  m_trace.resize(done);
+
+  if (m_trace.size() < header_size ||
+      std::memcmp(m_trace.data(), magic, sizeof(magic)) != 0)
+    throw std::runtime_error(path.generic_string() + " is not a trace");
+
+  if (bytes::read_le<uint16_t>(m_trace.data() + 4) != version)
+    throw std::runtime_error(path.generic_string() +
+                             " has an unsupported trace version");
+
+  // A unit that lost power leaves its last entry cut short, which ends the
+  // trace rather than spoils it.
+  size_t end = header_size;
+  while (end < m_trace.size()) {
+    const size_t size = entry_size(m_trace.data() + end, m_trace.size() - end);
+    if (size == 0)
+      break;
+    end += size;
+  }
+
+  if (end < m_trace.size()) {
+    text::err() << "replay: " << path.generic_string() << " ends with "
+                << m_trace.size() - end
+                << " bytes that aren't a complete entry, ignored"
+                << text::endl;
+    m_trace.resize(end);
+  }
+
+  m_gpio = bytes::read_le<uint16_t>(m_trace.data() + 6) & flag_gpio;
+  m_recorded_start_ns = bytes::read_le<uint64_t>(m_trace.data() + 8);
+  m_started_ns = stats::now_ns();
+}
+
+void replay::damaged() const {
+  text::err() << "replay: trace is damaged at offset " << m_offset
+              << text::endl;
+  throw i2c::error(true, EPROTO, 1);
+}
+
+byte replay::next() {
+  if (finished())
+    return 0;
+
+  const byte tag = m_trace[m_offset++];
+
+  uint64_t delta_us;
+  const size_t used = bytes::get_varint(m_trace.data() + m_offset,
+                                        m_trace.size() - m_offset, delta_us);
+  if (used == 0)
+    damaged();
+
+  m_offset += used;
+  m_recorded_us += delta_us;
+  ++m_entries;
+
+  if (m_speed > 0) {
+    const uint64_t due = m_started_ns + m_recorded_us * 1000 / m_speed;
+    const timespec ts{static_cast<time_t>(due / 1000000000),
+                      static_cast<long>(due % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+           EINTR)
+      ;
+  }
+
+  return tag;
+}
+
+int replay::transfer(i2c_msg *messages, unsigned count) {
+  if (finished())
+    return ENODATA;
+
+  const size_t entry = m_offset;
+  const uint64_t recorded_us = m_recorded_us;
+  const byte tag = next();
+
+  const i2c_msg *write = nullptr;
+  i2c_msg *read = nullptr;
+  for (unsigned i = 0; i < count && i < 2; ++i) {
+    if (messages[i].flags & I2C_M_RD)
+      read = &messages[i];
+    else if (!read)
+      write = &messages[i];
+  }
+
+  auto length = [this](bool with_bytes) {
+    uint64_t len;
+    const size_t used = bytes::get_varint(m_trace.data() + m_offset,
+                                          m_trace.size() - m_offset, len);
+    if (used == 0 || (with_bytes && len > m_trace.size() - m_offset - used))
+      damaged();
+
+    m_offset += used;
+    return len;
+  };
+
+  bool match = !(tag & tag_gpio) && bool(tag & tag_write) == bool(write) &&
+               bool(tag & tag_read) == bool(read);
+
+  if (match) {
+    if (m_offset >= m_trace.size())
+      damaged();
+    match = m_trace[m_offset++] == messages[0].addr;
+  }
+
+  if (match && write) {
+    const uint64_t len = length(true);
+    match = len == write->len &&
+            std::memcmp(m_trace.data() + m_offset, write->buf, len) == 0;
+    m_offset += len;
+  }
+
+  if (match && read) {
+    const uint64_t len = length(!(tag & tag_failed));
+    match = len == read->len;
+    if (match && !(tag & tag_failed)) {
+      std::memcpy(read->buf, m_trace.data() + m_offset, len);
+      m_offset += len;
+    }
+  }
+
+  if (!match) {
+    text::err() << "replay: transaction " << m_entries << " at offset "
+                << entry << " doesn't match the trace" << text::endl;
+    m_offset = entry;
+    m_recorded_us = recorded_us;
+    --m_entries;
+    return EPROTO;
+  }
+
+  if (tag & tag_failed) {
+    uint64_t error;
+    const size_t used = bytes::get_varint(m_trace.data() + m_offset,
+                                          m_trace.size() - m_offset, error);
+    if (used == 0)
+      damaged();
+
+    m_offset += used;
+    return static_cast<int>(error);
+  }
+
+  return 0;
+}
+
+uint32_t replay::gpio() {
+  if (finished())
+    throw i2c::error(true, ENODATA, 1);
+
+  const size_t entry = m_offset;
+  const uint64_t recorded_us = m_recorded_us;
+  if (next() != tag_gpio) {
+    m_offset = entry;
+    m_recorded_us = recorded_us;
+    --m_entries;
+    text::err() << "replay: expected a GPIO input at offset " << entry
+                << text::endl;
+    throw i2c::error(true, EPROTO, 1);
+  }
+
+  uint64_t value;
+  const size_t used = bytes::get_varint(m_trace.data() + m_offset,
+                                        m_trace.size() - m_offset, value);
+  if (used == 0)
+    damaged();
+
+  m_offset += used;
+  return static_cast<uint32_t>(value);
+}
+
+} // namespace trace
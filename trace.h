@@ -0,0 +1,143 @@
+#pragma once
+
+#include "i2c.h"
+
+#include <cstdint>
+#include <ctime>
+#include <filesystem>
+
+// Register level traces: everything that goes over the bus, recorded with
+// negligible overhead and played back later to the same code, so an odd
+// behaviour seen in the field can be reproduced on a desk.
+//
+// A trace holds the inputs of the daemon: every i2c transaction, plus GPIO
+// values such as edge counts, which main records explicitly. Time is kept
+// as microseconds since the previous entry.
+//
+// File format, little endian, integers marked varint are LEB128:
+//   "SW6R", u16 version, u16 flags (bit 0: GPIO interrupts were used),
+//   u64 CLOCK_REALTIME nanoseconds of the start
+//   entries, each starting with a tag byte and the varint time delta:
+//     transaction: tag bit 1 write, bit 2 read, bit 3 failed
+//       u8 address
+//       write: varint length, bytes (register, then any payload)
+//       read: varint length, bytes (not present if failed)
+//       failed: varint errno
+//     GPIO value: tag 0x01, varint value
+//
+// A register read takes about 8 bytes.
+
+struct i2c_msg;
+
+namespace trace {
+
+namespace fs = std::filesystem;
+
+static constexpr uint16_t version = 1;
+
+/**
+ * Records into a trace file. Entries are buffered and written out every
+ * 4 KiB or every second, whichever comes first. Recording never allocates
+ * after construction and never throws, a failed write is reported once and
+ * ends the recording.
+ */
+class writer : public i2c::recorder {
+  int m_fd = -1;
+  bytes::vect m_buffer;
+  uint64_t m_last_ns;
+  uint64_t m_flushed_ns;
+  uint64_t m_entries = 0;
+
+  void begin(bytes::byte tag);
+  void flush();
+
+public:
+  /**
+   * @param gpio whether the daemon runs on GPIO interrupts, which replay
+   * has to know.
+   * @throw std::runtime_error if the file can't be created.
+   */
+  writer(const fs::path &path, bool gpio);
+  ~writer();
+
+  writer(const writer &) = delete;
+  writer &operator=(const writer &) = delete;
+
+  /**
+   * Record a transaction as it was passed to the adapter.
+   * @param error errno of a failed transaction, 0 if it went through.
+   */
+  void transaction(const i2c_msg *messages, unsigned count,
+                   int error) override;
+
+  /// Record a GPIO input.
+  void gpio(uint32_t value);
+
+  uint64_t entries() const { return m_entries; }
+};
+
+/**
+ * Plays a trace back in place of the adapter. Transactions have to come in
+ * the recorded order and match the recorded ones, which they do as long as
+ * the code sending them behaves the same.
+ */
+class replay : public i2c::bus {
+  bytes::vect m_trace;
+  size_t m_offset;
+  bool m_gpio;
+  unsigned m_speed;
+  uint64_t m_recorded_start_ns; // CLOCK_REALTIME
+
+  // Recorded time of the next entry, microseconds since the start.
+  uint64_t m_recorded_us = 0;
+  uint64_t m_started_ns;
+  uint64_t m_entries = 0;
+
+  // Parses the tag and the time of the next entry and waits until it is
+  // due.
+  bytes::byte next();
+  [[noreturn]] void damaged() const;
+
+public:
+  /**
+   * A partial entry at the end, as a power cut leaves it, is dropped with a
+   * warning.
+   * @param speed how many times faster than recorded to play back, 0 to not
+   * wait at all.
+   * @throw std::runtime_error if the file can't be read or is no trace.
+   */
+  replay(const fs::path &path, unsigned speed);
+
+  /// Whether the trace was recorded with GPIO interrupts.
+  bool gpio_enabled() const { return m_gpio; }
+
+  /// True once every entry was played back.
+  bool finished() const { return m_offset == m_trace.size(); }
+
+  /**
+   * Play back the next transaction.
+   * @return the recorded errno, EPROTO if the transaction differs from the
+   * recorded one, ENODATA past the end of the trace.
+   */
+  int transfer(i2c_msg *messages, unsigned count) override;
+
+  /**
+   * Play back the next GPIO input.
+   * @throw i2c::error, fatal, if the next entry is not one or the trace
+   * ended. The loop stops on it like on a bus that's gone.
+   */
+  uint32_t gpio();
+
+  uint64_t entries() const { return m_entries; }
+  /// Recorded time played back so far.
+  std::chrono::microseconds recorded() const {
+    return std::chrono::microseconds(m_recorded_us);
+  }
+
+  /// Wall clock time the last entry played back was recorded at.
+  time_t wall_time() const {
+    return (m_recorded_start_ns / 1000 + m_recorded_us) / 1000000;
+  }
+};
+
+} // namespace trace